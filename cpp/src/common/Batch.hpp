@@ -0,0 +1,293 @@
+#pragma once
+
+// Batch mode: many files in one WTP connection. The DATA payloads carry one
+// logical stream, a manifest followed by every file's bytes back to back:
+//
+//   magic u32, file count u32, manifest length u64 (including this header)
+//   per file: size u64, path length u16, relative path
+//   contents of file 0, file 1, ...
+//
+// All integers are big endian. Paths are relative and use '/'.
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <spdlog/spdlog.h>
+
+namespace batch
+{
+
+constexpr uint32_t MAGIC = 0x57545042; // "WTPB"
+constexpr size_t HEADER_SIZE = 16;
+constexpr size_t MAX_MANIFEST = size_t(1) << 30;
+
+struct Entry
+{
+    std::string path; // relative to the batch root
+    uint64_t size = 0;
+};
+
+inline void putBe(std::vector<uint8_t> &out, uint64_t v, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--)
+        out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+inline uint64_t getBe(const uint8_t *p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+inline std::vector<uint8_t> encodeManifest(const std::vector<Entry> &entries)
+{
+    std::vector<uint8_t> out;
+    putBe(out, MAGIC, 4);
+    putBe(out, entries.size(), 4);
+    putBe(out, 0, 8); // patched below
+    for (const Entry &e : entries)
+    {
+        putBe(out, e.size, 8);
+        putBe(out, e.path.size(), 2);
+        out.insert(out.end(), e.path.begin(), e.path.end());
+    }
+    std::vector<uint8_t> length;
+    putBe(length, out.size(), 8);
+    std::copy(length.begin(), length.end(), out.begin() + 8);
+    return out;
+}
+
+// A path from the manifest is only written if it stays under the root.
+inline bool safePath(const std::string &path)
+{
+    std::filesystem::path p(path);
+    if (path.empty() || p.is_absolute())
+        return false;
+    for (const auto &part : p)
+        if (part == ".." || part == "." || part.empty())
+            return false;
+    return true;
+}
+
+// Produces the batch stream of the files under root in order, a read at a
+// time, so only what the caller asks for is ever in memory. A file that
+// has shrunk since it was listed is padded with zeros, keeping the sizes in
+// the manifest right.
+class Reader
+{
+public:
+    Reader(std::string root, std::vector<Entry> entries)
+        : root(std::move(root)), entries(std::move(entries)), manifest(encodeManifest(this->entries)), ioBuffer(1 << 20)
+    {
+    }
+
+    // Bytes in the whole stream, manifest included.
+    uint64_t size() const
+    {
+        uint64_t total = manifest.size();
+        for (const Entry &e : entries)
+            total += e.size;
+        return total;
+    }
+
+    // Fills dst with the next len bytes of the stream.
+    void read(uint8_t *dst, size_t len)
+    {
+        while (len > 0)
+        {
+            if (manifestRead < manifest.size())
+            {
+                size_t take = std::min(len, manifest.size() - manifestRead);
+                std::copy_n(manifest.data() + manifestRead, take, dst);
+                manifestRead += take;
+                dst += take;
+                len -= take;
+                continue;
+            }
+            if (current >= entries.size())
+            {
+                std::fill_n(dst, len, 0);
+                return;
+            }
+            const Entry &e = entries[current];
+            if (e.size > 0 && done == 0)
+            {
+                in.rdbuf()->pubsetbuf(ioBuffer.data(), static_cast<std::streamsize>(ioBuffer.size()));
+                in.open(std::filesystem::path(root) / e.path, std::ios::binary);
+                if (!in)
+                    spdlog::error("Cannot read batch file {}", e.path);
+            }
+            size_t take = static_cast<size_t>(std::min<uint64_t>(len, e.size - done));
+            size_t got = 0;
+            if (in) // once a read comes up short, the rest of the file is zeros
+            {
+                in.read(reinterpret_cast<char *>(dst), static_cast<std::streamsize>(take));
+                got = static_cast<size_t>(in.gcount());
+                if (got < take)
+                    spdlog::error("Read only {} of {} bytes of {}", done + got, e.size, e.path);
+            }
+            std::fill_n(dst + got, take - got, 0);
+            dst += take;
+            len -= take;
+            done += take;
+            if (done == e.size)
+            {
+                in.close();
+                in.clear();
+                current++;
+                done = 0;
+            }
+        }
+    }
+
+private:
+    std::string root;
+    std::vector<Entry> entries;
+    std::vector<uint8_t> manifest;
+    size_t manifestRead = 0;
+    size_t current = 0;
+    uint64_t done = 0; // bytes of entries[current] so far
+    std::ifstream in;
+    std::vector<char> ioBuffer;
+};
+
+// Consumes the batch stream in order and writes each file under root.
+class Writer
+{
+public:
+    explicit Writer(std::string root) : root(std::move(root)) {}
+
+    void write(const uint8_t *data, size_t len)
+    {
+        while (len > 0)
+        {
+            if (!parsed)
+            {
+                size_t take = headerNeeded() - pending.size();
+                take = std::min(take, len);
+                pending.insert(pending.end(), data, data + take);
+                data += take;
+                len -= take;
+                if (pending.size() >= HEADER_SIZE && pending.size() == headerNeeded())
+                    parseManifest();
+                continue;
+            }
+            if (current >= entries.size())
+            {
+                spdlog::error("Batch stream carries {} bytes past its last file", len);
+                return;
+            }
+            size_t take = static_cast<size_t>(std::min<uint64_t>(len, entries[current].size - written));
+            if (out.is_open())
+                out.write(reinterpret_cast<const char *>(data), static_cast<std::streamsize>(take));
+            data += take;
+            len -= take;
+            written += take;
+            if (written == entries[current].size)
+                nextFile();
+        }
+    }
+
+    // True once every file in the manifest has been written in full.
+    bool complete() const
+    {
+        return parsed && current == entries.size();
+    }
+
+    size_t fileCount() const
+    {
+        return entries.size();
+    }
+
+private:
+    std::string root;
+    std::vector<uint8_t> pending; // the manifest, until all of it is here
+    bool parsed = false;
+    std::vector<Entry> entries;
+    size_t current = 0;
+    uint64_t written = 0; // bytes of entries[current] so far
+    std::ofstream out;
+
+    size_t headerNeeded() const
+    {
+        if (pending.size() < HEADER_SIZE)
+            return HEADER_SIZE;
+        uint64_t declared = getBe(pending.data() + 8, 8);
+        return static_cast<size_t>(std::clamp<uint64_t>(declared, HEADER_SIZE, MAX_MANIFEST));
+    }
+
+    void parseManifest()
+    {
+        const uint8_t *p = pending.data();
+        const uint8_t *end = p + pending.size();
+        if (getBe(p, 4) != MAGIC)
+        {
+            spdlog::error("Batch stream does not start with a manifest");
+            entries.clear();
+            parsed = true;
+            return;
+        }
+        uint32_t count = static_cast<uint32_t>(getBe(p + 4, 4));
+        p += HEADER_SIZE;
+        for (uint32_t i = 0; i < count && p + 10 <= end; i++)
+        {
+            Entry e;
+            e.size = getBe(p, 8);
+            size_t pathLen = static_cast<size_t>(getBe(p + 8, 2));
+            p += 10;
+            if (p + pathLen > end)
+                break;
+            e.path.assign(reinterpret_cast<const char *>(p), pathLen);
+            p += pathLen;
+            entries.push_back(std::move(e));
+        }
+        pending.clear();
+        pending.shrink_to_fit();
+        parsed = true;
+        spdlog::info("Batch of {} files", entries.size());
+        current = 0;
+        openCurrent();
+    }
+
+    // Opens entries[current], finishing any empty files on the way.
+    void openCurrent()
+    {
+        while (current < entries.size())
+        {
+            written = 0;
+            const Entry &e = entries[current];
+            if (safePath(e.path))
+            {
+                std::filesystem::path target = std::filesystem::path(root) / e.path;
+                std::error_code ec;
+                std::filesystem::create_directories(target.parent_path(), ec);
+                out.open(target, std::ios::binary | std::ios::trunc);
+                if (!out)
+                    spdlog::error("Cannot write batch file {}", target.string());
+            }
+            else
+            {
+                spdlog::error("Skipping batch file with unsafe path \"{}\"", e.path);
+            }
+            if (e.size > 0)
+                return;
+            out.close();
+            current++;
+        }
+    }
+
+    void nextFile()
+    {
+        out.close();
+        current++;
+        openCurrent();
+    }
+};
+
+} // namespace batch
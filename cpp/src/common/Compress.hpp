@@ -0,0 +1,95 @@
+#pragma once
+
+// Per-chunk compression for WTP's compressed DATA packets (type CDATA). Each
+// chunk is an independent raw deflate stream at the fastest level, so a lost
+// or reordered packet never affects its neighbours. The z_streams are reset
+// rather than rebuilt between chunks, so steady state does not allocate.
+
+#include <cstddef>
+#include <cstdint>
+#include <zlib.h>
+
+class ChunkCompressor
+{
+public:
+    ChunkCompressor()
+    {
+        deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    }
+    ~ChunkCompressor() { deflateEnd(&zs); }
+    ChunkCompressor(const ChunkCompressor &) = delete;
+    ChunkCompressor &operator=(const ChunkCompressor &) = delete;
+
+    // Compresses len bytes into out, which has room for len - 1 bytes, and
+    // returns the compressed size; 0 means the chunk is better sent raw.
+    //
+    // Incompressible data (media, archives) tends to come in long runs, so
+    // after a miss the next few chunks are sent raw without trying, backing
+    // off up to MAX_SKIP chunks; one hit resets the back-off.
+    size_t compress(const uint8_t *in, size_t len, uint8_t *out)
+    {
+        if (skip > 0)
+        {
+            skip--;
+            return 0;
+        }
+        size_t outLen = tryCompress(in, len, out);
+        if (outLen == 0)
+        {
+            backoff = backoff ? (backoff * 2 > MAX_SKIP ? MAX_SKIP : backoff * 2) : 1;
+            skip = backoff;
+        }
+        else
+        {
+            backoff = 0;
+        }
+        return outLen;
+    }
+
+private:
+    static constexpr uint32_t MAX_SKIP = 32;
+
+    z_stream zs{};
+    uint32_t skip = 0;
+    uint32_t backoff = 0;
+
+    size_t tryCompress(const uint8_t *in, size_t len, uint8_t *out)
+    {
+        if (len < 2)
+            return 0;
+        deflateReset(&zs);
+        zs.next_in = const_cast<Bytef *>(in);
+        zs.avail_in = static_cast<uInt>(len);
+        zs.next_out = out;
+        zs.avail_out = static_cast<uInt>(len - 1);
+        if (deflate(&zs, Z_FINISH) != Z_STREAM_END)
+            return 0; // ran out of room: not worth it
+        return len - 1 - zs.avail_out;
+    }
+};
+
+class ChunkDecompressor
+{
+public:
+    ChunkDecompressor() { inflateInit2(&zs, -15); }
+    ~ChunkDecompressor() { inflateEnd(&zs); }
+    ChunkDecompressor(const ChunkDecompressor &) = delete;
+    ChunkDecompressor &operator=(const ChunkDecompressor &) = delete;
+
+    // Returns the decompressed size, or -1 if the data is not a complete
+    // deflate stream that fits in capacity bytes.
+    long decompress(const uint8_t *in, size_t len, uint8_t *out, size_t capacity)
+    {
+        inflateReset(&zs);
+        zs.next_in = const_cast<Bytef *>(in);
+        zs.avail_in = static_cast<uInt>(len);
+        zs.next_out = out;
+        zs.avail_out = static_cast<uInt>(capacity);
+        if (inflate(&zs, Z_FINISH) != Z_STREAM_END)
+            return -1;
+        return static_cast<long>(capacity - zs.avail_out);
+    }
+
+private:
+    z_stream zs{};
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+// Checksums a payload while copying it, for the paths that copy anyway:
+// a sender copying a chunk behind its header, a receiver copying a verified
+// payload to where it is headed. Each block is loaded once, fed to the CRC
+// and stored from the same register, and the result is what crc32() or
+// crc32c() returns for src. src and dst must not overlap.
+//
+// CRC32 runs Crc32.hpp's PCLMULQDQ fold with stores; CRC32C a storing copy
+// of Crc32c.hpp's interleaved kernel. Without them the byte-wise tables
+// store as they go. In cache the saving is at most the separate memcpy;
+// it grows once payloads no longer fit the cache.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Crc32.hpp"
+#include "Crc32c.hpp"
+
+namespace copysum
+{
+
+inline uint32_t tableCrc32(uint32_t crc, uint8_t *dst, const uint8_t *src, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        dst[i] = src[i];
+        crc = crc32_tab[(crc ^ src[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+inline uint32_t tableCrc32c(uint32_t crc, uint8_t *dst, const uint8_t *src, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        dst[i] = src[i];
+        crc = castagnoli::TABLE[(crc ^ src[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef WTP_CRC32C_HW
+// castagnoli::interleaved, storing each word it loads.
+WTP_CRC32C_HW inline uint32_t interleaved(uint32_t crc0, uint8_t *dst, const uint8_t *src, size_t len, const castagnoli::Shift &join)
+{
+    uint32_t crc1 = 0, crc2 = 0;
+    for (size_t i = 0; i < len; i += 8)
+    {
+        uint64_t a, b, c;
+        memcpy(&a, src + i, 8);
+        memcpy(&b, src + len + i, 8);
+        memcpy(&c, src + 2 * len + i, 8);
+        memcpy(dst + i, &a, 8);
+        memcpy(dst + len + i, &b, 8);
+        memcpy(dst + 2 * len + i, &c, 8);
+        crc0 = castagnoli::stepValue(crc0, a);
+        crc1 = castagnoli::stepValue(crc1, b);
+        crc2 = castagnoli::stepValue(crc2, c);
+    }
+    crc0 = castagnoli::shift(join, crc0) ^ crc1;
+    return castagnoli::shift(join, crc0) ^ crc2;
+}
+
+WTP_CRC32C_HW inline uint32_t hardwareCrc32c(uint32_t crc, uint8_t *dst, const uint8_t *src, size_t size)
+{
+    for (size_t block : {castagnoli::LONG, castagnoli::SHORT})
+    {
+        const castagnoli::Shift &join = block == castagnoli::LONG ? castagnoli::LONG_SHIFT : castagnoli::SHORT_SHIFT;
+        for (; size >= 3 * block; dst += 3 * block, src += 3 * block, size -= 3 * block)
+            crc = interleaved(crc, dst, src, block, join);
+    }
+    for (; size >= 8; dst += 8, src += 8, size -= 8)
+    {
+        uint64_t w;
+        memcpy(&w, src, 8);
+        memcpy(dst, &w, 8);
+        crc = castagnoli::stepValue(crc, w);
+    }
+    for (size_t i = 0; i < size; i++)
+    {
+        dst[i] = src[i];
+        crc = castagnoli::stepByte(crc, src[i]);
+    }
+    return crc;
+}
+#else
+inline uint32_t hardwareCrc32c(uint32_t crc, uint8_t *dst, const uint8_t *src, size_t size)
+{
+    return tableCrc32c(crc, dst, src, size);
+}
+#endif
+
+} // namespace copysum
+
+// Copies size bytes from src to dst and returns their crc32().
+inline uint32_t crc32Copy(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = static_cast<uint8_t *>(dst);
+    const uint8_t *s = static_cast<const uint8_t *>(src);
+    uint32_t crc = ~0u;
+    if (ieee::CLMUL && size >= ieee::FOLD_MIN)
+    {
+        size_t blocks = size & ~size_t(15);
+        crc = ieee::fold<true>(crc, d, s, blocks);
+        d += blocks;
+        s += blocks;
+        size -= blocks;
+    }
+    return copysum::tableCrc32(crc, d, s, size) ^ ~0u;
+}
+
+// Copies size bytes from src to dst and returns their crc32c().
+inline uint32_t crc32cCopy(void *dst, const void *src, size_t size)
+{
+    uint8_t *d = static_cast<uint8_t *>(dst);
+    const uint8_t *s = static_cast<const uint8_t *>(src);
+    uint32_t crc = castagnoli::HARDWARE ? copysum::hardwareCrc32c(~0u, d, s, size) : copysum::tableCrc32c(~0u, d, s, size);
+    return crc ^ ~0u;
+}
@@ -1,3 +1,5 @@
+#pragma once
+
 /*-
  *  COPYRIGHT (C) 1986 Gary S. Brown.  You may use this program, or
  *  code or tables extracted from it, as desired without restriction.
@@ -40,9 +42,16 @@
  * CRC32 code derived from work by Gary S. Brown.
  */
 
+#include <cstddef>
 #include <cstdint>
 #include <sys/param.h>
 
+#if defined(__x86_64__)
+#include <smmintrin.h>
+#include <wmmintrin.h>
+#define WTP_CLMUL __attribute__((target("pclmul,sse4.1")))
+#endif
+
 static uint32_t crc32_tab[] = {
     0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
     0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
@@ -88,6 +97,110 @@ static uint32_t crc32_tab[] = {
     0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
     0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d};
 
+// Where the CPU has carry-less multiplies (PCLMULQDQ), buffers of at least
+// FOLD_MIN bytes are folded 64 bytes a step instead of run through the
+// table, as in Intel's "Fast CRC Computation for Generic Polynomials Using
+// PCLMULQDQ" and zlib's crc32_simd.c. CopyChecksum.hpp runs the same fold
+// with a store of each block.
+namespace ieee
+{
+
+constexpr size_t FOLD_MIN = 64;
+
+inline uint32_t software(uint32_t crc, const uint8_t *p, size_t size)
+{
+    while (size--)
+        crc = crc32_tab[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    return crc;
+}
+
+#ifdef WTP_CLMUL
+inline bool detect()
+{
+    __builtin_cpu_init(); // may run before libgcc's own constructor
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+}
+
+// Loads the block at src + at, and with STORE also stores it at dst + at.
+template <bool STORE>
+WTP_CLMUL inline __m128i load(uint8_t *dst, const uint8_t *src, size_t at)
+{
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + at));
+    if constexpr (STORE)
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + at), x);
+    return x;
+}
+
+// Carries x across the distance k stands for and adds next.
+WTP_CLMUL inline __m128i fold(__m128i x, __m128i k, __m128i next)
+{
+    __m128i lo = _mm_clmulepi64_si128(x, k, 0x00);
+    __m128i hi = _mm_clmulepi64_si128(x, k, 0x11);
+    return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+}
+
+// Runs size bytes at src, a multiple of 16 and at least FOLD_MIN, through
+// crc; with STORE also copies them to dst, which is not read otherwise.
+template <bool STORE>
+WTP_CLMUL inline uint32_t fold(uint32_t crc, uint8_t *dst, const uint8_t *src, size_t size)
+{
+    // x^(n*8) mod P for the fold distances, bit-reflected: 512 bits,
+    // 128 bits, 64 bits, then P and its Barrett constant.
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i low32 = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_xor_si128(load<STORE>(dst, src, 0), _mm_cvtsi32_si128(static_cast<int>(crc)));
+    __m128i x2 = load<STORE>(dst, src, 16);
+    __m128i x3 = load<STORE>(dst, src, 32);
+    __m128i x4 = load<STORE>(dst, src, 48);
+    size_t at = 64;
+    for (; at + 64 <= size; at += 64)
+    {
+        x1 = fold(x1, k1k2, load<STORE>(dst, src, at));
+        x2 = fold(x2, k1k2, load<STORE>(dst, src, at + 16));
+        x3 = fold(x3, k1k2, load<STORE>(dst, src, at + 32));
+        x4 = fold(x4, k1k2, load<STORE>(dst, src, at + 48));
+    }
+    x1 = fold(x1, k3k4, x2);
+    x1 = fold(x1, k3k4, x3);
+    x1 = fold(x1, k3k4, x4);
+    for (; at < size; at += 16)
+        x1 = fold(x1, k3k4, load<STORE>(dst, src, at));
+
+    // 128 bits to 64, then Barrett reduction to 32.
+    __m128i x = _mm_xor_si128(_mm_srli_si128(x1, 8), _mm_clmulepi64_si128(x1, k3k4, 0x10));
+    x = _mm_xor_si128(_mm_srli_si128(x, 4), _mm_clmulepi64_si128(_mm_and_si128(x, low32), k5, 0x00));
+    __m128i t = _mm_clmulepi64_si128(_mm_and_si128(x, low32), poly, 0x10);
+    t = _mm_clmulepi64_si128(_mm_and_si128(t, low32), poly, 0x00);
+    return static_cast<uint32_t>(_mm_extract_epi32(_mm_xor_si128(x, t), 1));
+}
+#else
+inline bool detect()
+{
+    return false;
+}
+
+template <bool STORE>
+inline uint32_t fold(uint32_t crc, uint8_t *dst, const uint8_t *src, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        if constexpr (STORE)
+            dst[i] = src[i];
+        crc = crc32_tab[(crc ^ src[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+#endif
+
+// Chosen once, when the program starts.
+inline const bool CLMUL = detect();
+
+} // namespace ieee
+
 inline uint32_t crc32(const void *buf, size_t size) {
     uint32_t crc = 0;
     const uint8_t *p;
@@ -95,8 +208,12 @@ inline uint32_t crc32(const void *buf, size_t size) {
     p = (const uint8_t *)buf;
     crc = crc ^ ~0U;
 
-    while (size--)
-        crc = crc32_tab[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    if (ieee::CLMUL && size >= ieee::FOLD_MIN) {
+        size_t blocks = size & ~size_t(15);
+        crc = ieee::fold<false>(crc, nullptr, p, blocks);
+        p += blocks;
+        size -= blocks;
+    }
 
-    return crc ^ ~0U;
-}
\ No newline at end of file
+    return ieee::software(crc, p, size) ^ ~0U;
+}
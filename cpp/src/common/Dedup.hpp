@@ -0,0 +1,35 @@
+#pragma once
+
+// Chunk hashes for WTP's dedup mode. Before sending DATA the sender lists a
+// hash per chunk in MANIFEST packets (seqNum: the first chunk listed, payload:
+// HASH_SIZE bytes per chunk). The receiver answers each with the same seqNum
+// and a bitmap, bit i set when it already holds chunk seqNum + i.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Sha256.hpp"
+
+namespace dedup
+{
+
+// SHA-256 truncated to 128 bits: collision resistant enough to trust a match
+// without comparing bytes, at half the manifest size.
+constexpr size_t HASH_SIZE = 16;
+
+inline void chunkHash(const uint8_t *data, size_t len, uint8_t *out)
+{
+    sha256::Digest d = sha256::hash(data, len);
+    memcpy(out, d.data(), HASH_SIZE);
+}
+
+inline bool matches(const uint8_t *data, size_t len, const uint8_t *hash)
+{
+    uint8_t mine[HASH_SIZE];
+    chunkHash(data, len, mine);
+    return memcmp(mine, hash, HASH_SIZE) == 0;
+}
+
+} // namespace dedup
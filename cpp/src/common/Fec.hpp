@@ -0,0 +1,178 @@
+#pragma once
+
+// Systematic Reed-Solomon erasure code for WTP's FEC mode.
+//
+// For a group of k consecutive DATA packets the sender emits m parity packets
+// (type FEC). Each data packet is turned into a symbol of symLen bytes:
+//
+//   [packet type][payload length, 16-bit big endian][payload][zero padding]
+//
+// where symLen is 3 + the longest payload in the group, and parity row j is
+// sum_i coef(j, i) * symbol_i. The coefficients form a Cauchy matrix with its
+// columns scaled so that row 0 is all ones, which keeps every square submatrix
+// invertible (any k of the k + m symbols rebuild the group) and makes m = 1
+// plain XOR parity.
+//
+// A parity packet's seqNum is the group's first data seqNum and its payload is
+// a FecHeader followed by the parity symbol.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Gf256.hpp"
+
+namespace fec
+{
+
+constexpr uint32_t MAX_K = 64;
+constexpr uint32_t MAX_M = 8;
+
+struct FecHeader
+{
+    uint8_t k;     // data packets in the group
+    uint8_t m;     // parity packets in the group
+    uint8_t index; // which parity row this packet carries
+    uint8_t reserved;
+};
+
+// Bytes a parity packet needs beyond the longest data payload of its group.
+constexpr size_t OVERHEAD = sizeof(FecHeader) + 3;
+
+// An ACK for a packet the receiver rebuilt from parity carries a payload of
+// this length, so the sender can count losses that FEC hid from it.
+constexpr size_t REPAIRED_ACK_LENGTH = 1;
+
+inline uint8_t coef(uint32_t row, uint32_t col)
+{
+    uint8_t y = static_cast<uint8_t>(128 + col); // rows use x = row in [0, MAX_M)
+    return gf256::div(y, static_cast<uint8_t>(row) ^ y);
+}
+
+inline void makeSymbol(uint8_t *symbol, size_t symLen, uint32_t type, const uint8_t *payload, size_t len)
+{
+    symbol[0] = static_cast<uint8_t>(type);
+    symbol[1] = static_cast<uint8_t>(len >> 8);
+    symbol[2] = static_cast<uint8_t>(len);
+    memcpy(symbol + 3, payload, len);
+    memset(symbol + 3 + len, 0, symLen - 3 - len);
+}
+
+// Returns the payload length stored in a symbol and its packet type, or -1 if
+// the symbol cannot be valid. The payload starts at symbol + 3.
+inline long symbolPayload(const uint8_t *symbol, size_t symLen, uint32_t &type)
+{
+    size_t len = (static_cast<size_t>(symbol[1]) << 8) | symbol[2];
+    type = symbol[0];
+    return (len + 3 <= symLen) ? static_cast<long>(len) : -1;
+}
+
+// parity[j] = sum_i coef(j, i) * data[i] for j < m.
+inline void encode(uint32_t k, uint32_t m, const uint8_t *const *data, uint8_t *const *parity, size_t symLen)
+{
+    for (uint32_t j = 0; j < m; j++)
+    {
+        memset(parity[j], 0, symLen);
+        for (uint32_t i = 0; i < k; i++)
+            gf256::mulAdd(parity[j], data[i], coef(j, i), symLen);
+    }
+}
+
+// Rebuilds the data symbols with present[i] == false in place. parity[j] is
+// null for parity rows that were not received. Returns false when fewer
+// parity rows arrived than data symbols are missing.
+inline bool decode(uint32_t k, uint32_t m, uint8_t *const *data, const bool *present,
+                   const uint8_t *const *parity, size_t symLen)
+{
+    std::vector<uint32_t> missing, rows;
+    for (uint32_t i = 0; i < k; i++)
+        if (!present[i])
+            missing.push_back(i);
+    for (uint32_t j = 0; j < m && rows.size() < missing.size(); j++)
+        if (parity[j])
+            rows.push_back(j);
+    if (rows.size() < missing.size())
+        return false;
+    size_t d = missing.size();
+    if (d == 0)
+        return true;
+
+    // Syndromes: each used parity row minus the contribution of the data we have.
+    std::vector<std::vector<uint8_t>> syndrome(d, std::vector<uint8_t>(symLen));
+    for (size_t r = 0; r < d; r++)
+    {
+        memcpy(syndrome[r].data(), parity[rows[r]], symLen);
+        for (uint32_t i = 0; i < k; i++)
+            if (present[i])
+                gf256::mulAdd(syndrome[r].data(), data[i], coef(rows[r], i), symLen);
+    }
+
+    // Invert the d x d matrix coef(rows[r], missing[c]) by Gauss-Jordan elimination.
+    std::vector<uint8_t> a(d * d), b(d * d, 0);
+    for (size_t r = 0; r < d; r++)
+    {
+        for (size_t c = 0; c < d; c++)
+            a[r * d + c] = coef(rows[r], missing[c]);
+        b[r * d + r] = 1;
+    }
+    for (size_t c = 0; c < d; c++)
+    {
+        size_t pivot = c;
+        while (pivot < d && a[pivot * d + c] == 0)
+            pivot++;
+        if (pivot == d)
+            return false;
+        for (size_t x = 0; x < d; x++)
+        {
+            std::swap(a[c * d + x], a[pivot * d + x]);
+            std::swap(b[c * d + x], b[pivot * d + x]);
+        }
+        uint8_t scale = gf256::inv(a[c * d + c]);
+        for (size_t x = 0; x < d; x++)
+        {
+            a[c * d + x] = gf256::mul(a[c * d + x], scale);
+            b[c * d + x] = gf256::mul(b[c * d + x], scale);
+        }
+        for (size_t r = 0; r < d; r++)
+        {
+            uint8_t f = a[r * d + c];
+            if (r == c || f == 0)
+                continue;
+            for (size_t x = 0; x < d; x++)
+            {
+                a[r * d + x] ^= gf256::mul(f, a[c * d + x]);
+                b[r * d + x] ^= gf256::mul(f, b[c * d + x]);
+            }
+        }
+    }
+
+    for (size_t c = 0; c < d; c++)
+    {
+        uint8_t *out = data[missing[c]];
+        memset(out, 0, symLen);
+        for (size_t r = 0; r < d; r++)
+            gf256::mulAdd(out, syndrome[r].data(), b[c * d + r], symLen);
+    }
+    return true;
+}
+
+// Group shape for an estimated loss rate: more parity per data packet as
+// loss grows, and shorter groups so one burst does not sink a whole group.
+inline void chooseGroup(double lossRate, uint32_t &k, uint32_t &m)
+{
+    if (lossRate < 0.005)
+        k = 32, m = 1;
+    else if (lossRate < 0.02)
+        k = 16, m = 1;
+    else if (lossRate < 0.05)
+        k = 16, m = 2;
+    else if (lossRate < 0.10)
+        k = 16, m = 3;
+    else if (lossRate < 0.20)
+        k = 10, m = 4;
+    else
+        k = 8, m = 4;
+}
+
+} // namespace fec
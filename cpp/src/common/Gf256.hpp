@@ -0,0 +1,176 @@
+#pragma once
+
+// Arithmetic over GF(2^8) with the polynomial x^8+x^4+x^3+x^2+1 (0x11d), as
+// used by the Reed-Solomon parity in Fec.hpp.
+//
+// The hot operation is mulAdd (dst ^= c * src over a whole packet). It uses the
+// split-nibble method: c * b == lo[c][b & 15] ^ hi[c][b >> 4], so sixteen bytes
+// are multiplied with two table shuffles (pshufb on SSSE3, tbl on NEON). The
+// SSSE3 kernel is picked at runtime so the default x86-64 build still runs on
+// CPUs without it.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GF256_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define GF256_NEON 1
+#endif
+
+namespace gf256
+{
+
+struct Tables
+{
+    uint8_t exp[512];
+    uint8_t log[256];
+    uint8_t mulLo[256][16]; // c * x for x in [0, 16)
+    uint8_t mulHi[256][16]; // c * (x << 4) for x in [0, 16)
+};
+
+inline Tables buildTables()
+{
+    Tables t{};
+    unsigned x = 1;
+    for (int i = 0; i < 255; i++)
+    {
+        t.exp[i] = static_cast<uint8_t>(x);
+        t.log[x] = static_cast<uint8_t>(i);
+        x <<= 1;
+        if (x & 0x100)
+            x ^= 0x11d;
+    }
+    for (int i = 255; i < 512; i++)
+        t.exp[i] = t.exp[i - 255];
+
+    for (int c = 0; c < 256; c++)
+    {
+        for (int n = 0; n < 16; n++)
+        {
+            t.mulLo[c][n] = (c && n) ? t.exp[t.log[c] + t.log[n]] : 0;
+            t.mulHi[c][n] = (c && n) ? t.exp[t.log[c] + t.log[n << 4]] : 0;
+        }
+    }
+    return t;
+}
+
+inline const Tables &tables()
+{
+    static const Tables t = buildTables();
+    return t;
+}
+
+inline uint8_t mul(uint8_t a, uint8_t b)
+{
+    if (a == 0 || b == 0)
+        return 0;
+    const Tables &t = tables();
+    return t.exp[t.log[a] + t.log[b]];
+}
+
+inline uint8_t inv(uint8_t a)
+{
+    const Tables &t = tables();
+    return t.exp[255 - t.log[a]];
+}
+
+inline uint8_t div(uint8_t a, uint8_t b)
+{
+    if (a == 0)
+        return 0;
+    const Tables &t = tables();
+    return t.exp[t.log[a] + 255 - t.log[b]];
+}
+
+// dst ^= src
+inline void addTo(uint8_t *dst, const uint8_t *src, size_t len)
+{
+    size_t i = 0;
+#if GF256_X86
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(d, s));
+    }
+#elif GF256_NEON
+    for (; i + 16 <= len; i += 16)
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+#endif
+    for (; i < len; i++)
+        dst[i] ^= src[i];
+}
+
+inline void mulAddScalar(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    const uint8_t *lo = tables().mulLo[c];
+    const uint8_t *hi = tables().mulHi[c];
+    for (size_t i = 0; i < len; i++)
+        dst[i] ^= lo[src[i] & 15] ^ hi[src[i] >> 4];
+}
+
+#if GF256_X86
+__attribute__((target("ssse3"))) inline void mulAddSsse3(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables().mulLo[c]));
+    const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(tables().mulHi[c]));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        __m128i l = _mm_shuffle_epi8(lo, _mm_and_si128(s, mask));
+        __m128i h = _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask));
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), _mm_xor_si128(d, _mm_xor_si128(l, h)));
+    }
+    mulAddScalar(dst + i, src + i, c, len - i);
+}
+#endif
+
+#if GF256_NEON
+inline void mulAddNeon(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    const uint8x16_t lo = vld1q_u8(tables().mulLo[c]);
+    const uint8x16_t hi = vld1q_u8(tables().mulHi[c]);
+    const uint8x16_t mask = vdupq_n_u8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        uint8x16_t s = vld1q_u8(src + i);
+        uint8x16_t p = veorq_u8(vqtbl1q_u8(lo, vandq_u8(s, mask)), vqtbl1q_u8(hi, vshrq_n_u8(s, 4)));
+        vst1q_u8(dst + i, veorq_u8(vld1q_u8(dst + i), p));
+    }
+    mulAddScalar(dst + i, src + i, c, len - i);
+}
+#endif
+
+// dst ^= c * src
+inline void mulAdd(uint8_t *dst, const uint8_t *src, uint8_t c, size_t len)
+{
+    if (c == 0)
+        return;
+    if (c == 1)
+    {
+        addTo(dst, src, len);
+        return;
+    }
+#if GF256_X86
+    static const bool ssse3 = __builtin_cpu_supports("ssse3");
+    if (ssse3)
+    {
+        mulAddSsse3(dst, src, c, len);
+        return;
+    }
+#elif GF256_NEON
+    mulAddNeon(dst, src, c, len);
+    return;
+#endif
+    mulAddScalar(dst, src, c, len);
+}
+
+} // namespace gf256
@@ -0,0 +1,147 @@
+#pragma once
+
+// Log-linear latency histogram in the style of HdrHistogram. Values below
+// 64 get a bucket each; above that every power of two is cut into 32 equal
+// buckets, so any value is reported within 1/32 (3.1%) of itself while the
+// whole uint64_t range fits in 1920 fixed buckets. Recording is a shift, a
+// count-leading-zeros and a counter bump, with nothing allocated. Like
+// stats::Counter there is one writer, and any thread may read.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "Stats.hpp"
+
+namespace stats
+{
+
+class Histogram
+{
+public:
+    static constexpr unsigned SUB_BITS = 6;
+    static constexpr uint64_t SUB = uint64_t(1) << SUB_BITS; // exact buckets below this
+    static constexpr uint64_t HALF = SUB / 2;                 // buckets per power of two above
+    static constexpr size_t BUCKETS = SUB + (64 - SUB_BITS) * HALF;
+
+    void record(uint64_t v)
+    {
+        bump(counts[index(v)], 1);
+        bump(total, 1);
+        bump(sum, v);
+        if (v > maxValue.load(std::memory_order_relaxed))
+            maxValue.store(v, std::memory_order_relaxed);
+        if (v < minValue.load(std::memory_order_relaxed))
+            minValue.store(v, std::memory_order_relaxed);
+    }
+
+    // Adds o's samples into this one, e.g. to sum the stripes of a transfer.
+    void merge(const Histogram &o)
+    {
+        for (size_t i = 0; i < BUCKETS; i++)
+            bump(counts[i], o.counts[i].load(std::memory_order_relaxed));
+        bump(total, o.count());
+        bump(sum, o.sum.load(std::memory_order_relaxed));
+        maxValue.store(std::max(max(), o.max()), std::memory_order_relaxed);
+        minValue.store(std::min(minValue.load(std::memory_order_relaxed), o.minValue.load(std::memory_order_relaxed)),
+                       std::memory_order_relaxed);
+    }
+
+    void reset()
+    {
+        for (auto &c : counts)
+            c.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        maxValue.store(0, std::memory_order_relaxed);
+        minValue.store(UINT64_MAX, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const
+    {
+        return total.load(std::memory_order_relaxed);
+    }
+
+    uint64_t max() const
+    {
+        return maxValue.load(std::memory_order_relaxed);
+    }
+
+    uint64_t min() const
+    {
+        return count() ? minValue.load(std::memory_order_relaxed) : 0;
+    }
+
+    double mean() const
+    {
+        uint64_t n = count();
+        return n ? static_cast<double>(sum.load(std::memory_order_relaxed)) / n : 0.0;
+    }
+
+    // The value at or below which p percent of the samples fall, reported as
+    // the top of its bucket and never above the largest sample.
+    uint64_t percentile(double p) const
+    {
+        uint64_t n = count();
+        if (n == 0)
+            return 0;
+        uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(p / 100.0 * n)));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BUCKETS; i++)
+        {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(highestIn(i), max());
+        }
+        return max();
+    }
+
+    std::string json() const
+    {
+        return JsonObject()
+            .field("count", count())
+            .field("min", min())
+            .field("mean", mean())
+            .field("p50", percentile(50))
+            .field("p90", percentile(90))
+            .field("p99", percentile(99))
+            .field("p999", percentile(99.9))
+            .field("max", max())
+            .str();
+    }
+
+    static size_t index(uint64_t v)
+    {
+        if (v < SUB)
+            return static_cast<size_t>(v);
+        unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(v));
+        unsigned shift = msb - (SUB_BITS - 1); // leaves v >> shift in [HALF, SUB)
+        return static_cast<size_t>(SUB + (shift - 1) * HALF + ((v >> shift) - HALF));
+    }
+
+    static uint64_t highestIn(size_t i)
+    {
+        if (i < SUB)
+            return i;
+        uint64_t k = i - SUB;
+        unsigned shift = static_cast<unsigned>(k / HALF) + 1;
+        uint64_t low = (HALF + k % HALF) << shift;
+        return low + ((uint64_t(1) << shift) - 1);
+    }
+
+private:
+    std::atomic<uint64_t> counts[BUCKETS] = {};
+    std::atomic<uint64_t> total{0};
+    std::atomic<uint64_t> sum{0};
+    std::atomic<uint64_t> maxValue{0};
+    std::atomic<uint64_t> minValue{UINT64_MAX};
+
+    static void bump(std::atomic<uint64_t> &c, uint64_t n)
+    {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+};
+
+} // namespace stats
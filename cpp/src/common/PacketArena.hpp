@@ -0,0 +1,126 @@
+#pragma once
+
+// Packet storage for a whole flow in one page-aligned mapping: slot i holds
+// packet i at a fixed stride, rounded up to a cache line so no two packets
+// share one. The mapping is only reserved up front; pages are committed as
+// the packetizing threads first write them, each thread touching only its
+// own slots, and release() hands back the pages of packets that will never
+// be sent again. With hugePages the mapping comes from the hugetlb pool, or
+// failing that is marked for transparent huge pages.
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstddef>
+#include <cstdint>
+
+class PacketArena
+{
+public:
+    static constexpr size_t CACHE_LINE = 64;
+    static constexpr size_t HUGE_PAGE = size_t(2) << 20;
+
+    PacketArena() = default;
+    PacketArena(const PacketArena &) = delete;
+    PacketArena &operator=(const PacketArena &) = delete;
+
+    ~PacketArena()
+    {
+        clear();
+    }
+
+    // Returns false if the mapping failed; the arena is then empty.
+    bool reset(size_t count, size_t slotSize, bool hugePages = false)
+    {
+        clear();
+        stride = (slotSize + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+        page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t bytes = count * stride;
+        if (bytes == 0)
+        {
+            slots = count;
+            return true;
+        }
+
+        void *p = MAP_FAILED;
+#ifdef MAP_HUGETLB
+        if (hugePages)
+        {
+            mapped = roundUp(bytes, HUGE_PAGE);
+            p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED)
+                page = HUGE_PAGE;
+        }
+#endif
+        if (p == MAP_FAILED)
+        {
+            mapped = roundUp(bytes, page);
+            p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+            if (p == MAP_FAILED)
+            {
+                mapped = 0;
+                return false;
+            }
+#ifdef MADV_HUGEPAGE
+            if (hugePages)
+                madvise(p, mapped, MADV_HUGEPAGE);
+#endif
+        }
+        base = static_cast<uint8_t *>(p);
+        slots = count;
+        return true;
+    }
+
+    void clear()
+    {
+        if (base)
+            munmap(base, mapped);
+        base = nullptr;
+        mapped = released = 0;
+        slots = 0;
+    }
+
+    size_t count() const
+    {
+        return slots;
+    }
+
+    size_t slotStride() const
+    {
+        return stride;
+    }
+
+    uint8_t *slot(size_t i)
+    {
+        return base + i * stride;
+    }
+
+    const uint8_t *slot(size_t i) const
+    {
+        return base + i * stride;
+    }
+
+    // Returns the whole pages below slot first to the kernel. Reading a
+    // released slot gives zeros, so only call this for packets that are done.
+    void release(size_t first)
+    {
+        size_t end = first * stride / page * page;
+        if (!base || end <= released)
+            return;
+        madvise(base + released, end - released, MADV_DONTNEED);
+        released = end;
+    }
+
+private:
+    static size_t roundUp(size_t n, size_t to)
+    {
+        return (n + to - 1) / to * to;
+    }
+
+    uint8_t *base = nullptr;
+    size_t mapped = 0;   // bytes mapped at base
+    size_t released = 0; // bytes at the start already given back
+    size_t stride = 0;
+    size_t page = 4096;
+    size_t slots = 0;
+};
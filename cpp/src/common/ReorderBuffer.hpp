@@ -0,0 +1,115 @@
+#pragma once
+
+// Out-of-order payloads of one flow, held in a slab of window-size slots.
+// A receiver only buffers seqNums within one window of its in-order point,
+// so seqNum s can own slot s % window outright: storing, finding and
+// draining never search, and no memory is allocated after reset(). The
+// slab is left uninitialized, so with a large negotiated window only the
+// pages of slots actually used are ever committed.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+class ReorderBuffer
+{
+public:
+    void reset(size_t window, size_t slotSize)
+    {
+        size = slotSize;
+        bytes.reset(new uint8_t[window * slotSize]);
+        slots.assign(window, Slot{});
+        held = 0;
+    }
+
+    bool contains(uint32_t seq) const
+    {
+        if (slots.empty())
+            return false;
+        const Slot &s = slots[seq % slots.size()];
+        return s.used && s.seq == seq;
+    }
+
+    // Copies the payload into seq's slot, unless data already sits there (see
+    // slot()). Fails if it does not fit, or if the slot still holds another
+    // seqNum, which only happens when seq is not within a window of
+    // everything buffered.
+    bool put(uint32_t seq, const uint8_t *data, size_t length)
+    {
+        if (slots.empty() || length > size)
+            return false;
+        size_t i = seq % slots.size();
+        Slot &s = slots[i];
+        if (s.used)
+            return s.seq == seq;
+        if (data != bytes.get() + i * size)
+            memcpy(bytes.get() + i * size, data, length);
+        s = {seq, static_cast<uint32_t>(length), true};
+        held++;
+        return true;
+    }
+
+    // Where put() would store length bytes for seq, so the caller can write
+    // them there itself; nullptr if put() would not. Nothing is held until
+    // put() is called.
+    uint8_t *slot(uint32_t seq, size_t length)
+    {
+        if (slots.empty() || length > size || slots[seq % slots.size()].used)
+            return nullptr;
+        return bytes.get() + seq % slots.size() * size;
+    }
+
+    // Frees seq's slot and returns its payload, or nullptr if seq is not
+    // buffered. The bytes stay valid until the next put().
+    const uint8_t *take(uint32_t seq, size_t &length)
+    {
+        if (!contains(seq))
+            return nullptr;
+        size_t i = seq % slots.size();
+        slots[i].used = false;
+        held--;
+        length = slots[i].length;
+        return bytes.get() + i * size;
+    }
+
+    // Drops every payload below seq, for when the in-order point jumps.
+    void dropBelow(uint32_t seq)
+    {
+        if (held == 0)
+            return;
+        for (Slot &s : slots)
+        {
+            if (s.used && s.seq < seq)
+            {
+                s.used = false;
+                held--;
+            }
+        }
+    }
+
+    size_t count() const
+    {
+        return held;
+    }
+
+    // Slots not holding a payload.
+    size_t freeSlots() const
+    {
+        return slots.size() - held;
+    }
+
+private:
+    struct Slot
+    {
+        uint32_t seq = 0;
+        uint32_t length = 0;
+        bool used = false;
+    };
+
+    std::unique_ptr<uint8_t[]> bytes;
+    std::vector<Slot> slots;
+    size_t size = 0;
+    size_t held = 0;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+// Which chunks of a resumable transfer the receiver has written, persisted
+// next to the partial output so a restarted sender or receiver can pick the
+// transfer up again. A record only matches a transfer with the same ID, file
+// size and chunk size; anything else starts over.
+//
+// File layout (host byte order, the file never leaves this machine):
+//   magic u32, chunkSize u32, transferId u64, fileSize u64, bitmap bytes
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+class ResumeBitmap
+{
+public:
+    static constexpr uint32_t MAGIC = 0x57545052; // "WTPR"
+
+    uint64_t transferId = 0;
+    uint64_t fileSize = 0;
+    uint32_t chunkSize = 0;
+
+    void reset(uint64_t id, uint64_t size, uint32_t chunk)
+    {
+        transferId = id;
+        fileSize = size;
+        chunkSize = chunk;
+        bits.assign((numChunks() + 7) / 8, 0);
+    }
+
+    // Returns false, leaving this object untouched, unless path holds a
+    // record for exactly this transfer.
+    bool load(const std::string &path, uint64_t id, uint64_t size, uint32_t chunk)
+    {
+        std::ifstream in(path, std::ios::binary);
+        uint32_t magic = 0, fileChunk = 0;
+        uint64_t fileId = 0, fileLen = 0;
+        in.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+        in.read(reinterpret_cast<char *>(&fileChunk), sizeof(fileChunk));
+        in.read(reinterpret_cast<char *>(&fileId), sizeof(fileId));
+        in.read(reinterpret_cast<char *>(&fileLen), sizeof(fileLen));
+        if (!in || magic != MAGIC || fileChunk != chunk || fileId != id || fileLen != size || chunk == 0)
+            return false;
+        std::vector<uint8_t> loaded(((size + chunk - 1) / chunk + 7) / 8);
+        in.read(reinterpret_cast<char *>(loaded.data()), static_cast<std::streamsize>(loaded.size()));
+        if (!in)
+            return false;
+        reset(id, size, chunk);
+        bits = std::move(loaded);
+        return true;
+    }
+
+    // Writes a temporary file and renames it over path, so a crash mid-save
+    // leaves the previous record intact.
+    bool save(const std::string &path) const
+    {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            uint32_t magic = MAGIC;
+            out.write(reinterpret_cast<const char *>(&magic), sizeof(magic));
+            out.write(reinterpret_cast<const char *>(&chunkSize), sizeof(chunkSize));
+            out.write(reinterpret_cast<const char *>(&transferId), sizeof(transferId));
+            out.write(reinterpret_cast<const char *>(&fileSize), sizeof(fileSize));
+            out.write(reinterpret_cast<const char *>(bits.data()), static_cast<std::streamsize>(bits.size()));
+            if (!out)
+                return false;
+        }
+        return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    uint64_t numChunks() const
+    {
+        return chunkSize ? (fileSize + chunkSize - 1) / chunkSize : 0;
+    }
+
+    bool test(uint64_t chunk) const
+    {
+        return chunk < numChunks() && (bits[chunk / 8] >> (chunk % 8)) & 1;
+    }
+
+    void set(uint64_t chunk)
+    {
+        if (chunk < numChunks())
+            bits[chunk / 8] |= static_cast<uint8_t>(1 << (chunk % 8));
+    }
+
+    // The received chunks from first onward as runs [start, start + count),
+    // at most maxRuns of them. Leaving runs out is safe: the sender just sends
+    // those chunks again.
+    std::vector<std::pair<uint32_t, uint32_t>> runs(uint64_t first, size_t maxRuns) const
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> out;
+        uint64_t n = numChunks();
+        uint64_t c = first;
+        while (c < n && out.size() < maxRuns)
+        {
+            if (!test(c))
+            {
+                // Whole empty bytes are common in a fresh region; skip them at once.
+                if (c % 8 == 0 && bits[c / 8] == 0)
+                    c += 8;
+                else
+                    c++;
+                continue;
+            }
+            uint64_t start = c;
+            while (c < n && test(c))
+                c++;
+            out.emplace_back(static_cast<uint32_t>(start), static_cast<uint32_t>(c - start));
+        }
+        return out;
+    }
+
+private:
+    std::vector<uint8_t> bits;
+};
@@ -0,0 +1,67 @@
+#pragma once
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Each side owns one index and only reads the other's, and keeps a
+// cached copy of it so the shared cache line is touched only when the queue
+// looks full (producer) or empty (consumer).
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity) : slots(roundUp(capacity)), mask(slots.size() - 1) {}
+
+    SpscQueue(const SpscQueue &) = delete;
+    SpscQueue &operator=(const SpscQueue &) = delete;
+
+    // Producer side. On failure v is left untouched.
+    bool tryPush(T &&v)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - headCache == slots.size())
+        {
+            headCache = head.load(std::memory_order_acquire);
+            if (t - headCache == slots.size())
+                return false;
+        }
+        slots[t & mask] = std::move(v);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side.
+    bool tryPop(T &v)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tailCache)
+        {
+            tailCache = tail.load(std::memory_order_acquire);
+            if (h == tailCache)
+                return false;
+        }
+        v = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    static size_t roundUp(size_t n)
+    {
+        size_t p = 1;
+        while (p < n)
+            p <<= 1;
+        return p;
+    }
+
+    std::vector<T> slots;
+    const size_t mask;
+    alignas(64) std::atomic<size_t> head{0}; // next slot to pop
+    alignas(64) size_t tailCache = 0;        // consumer's view of tail
+    alignas(64) std::atomic<size_t> tail{0}; // next slot to push
+    alignas(64) size_t headCache = 0;        // producer's view of head
+};
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Optional payload carried by a START packet and by the ACK that answers it.
+// A plain WTP START has length 0, and a receiver that does not understand the
+// payload answers with a zero-length ACK, so an absent payload always means
+// "no extensions".
+//
+// On the wire the payload is a versioned list of capabilities: MAGIC, a
+// 16-bit version and 16 reserved bits, then TLVs of a 16-bit type, a 16-bit
+// length and the value, all in network order. The START lists what the sender
+// offers; the ACK lists the subset the receiver accepted, with values filled
+// in. A peer skips TLV types it does not know, so a new capability is rolled
+// out by giving it a type: peers that lack it simply never echo it back.
+struct StartOptions
+{
+    static constexpr uint32_t MAGIC = 0x57545054; // "WTPT"
+    static constexpr uint16_t VERSION = 1;        // the ACK carries the lower of the two
+    static constexpr uint32_t DEFAULT_PAYLOAD = 1456; // 1500-byte Ethernet frame
+    static constexpr uint32_t MAX_PAYLOAD = 65507 - 16; // largest UDP datagram minus our header
+
+    // Capabilities without a value; the ACK keeps only the ones the receiver agreed to.
+    static constexpr uint32_t FLAG_FEC = 1 << 0;
+    static constexpr uint32_t FLAG_COMPRESS = 1 << 1;
+    static constexpr uint32_t FLAG_RESUME = 1 << 2;
+    static constexpr uint32_t FLAG_DEDUP = 1 << 3;
+    static constexpr uint32_t FLAG_BATCH = 1 << 4; // DATA carries a batch stream, see Batch.hpp
+    static constexpr uint32_t FLAG_ZERO_RTT = 1 << 5; // DATA sent before the START ACK; CRCs are xored with sessionId
+    static constexpr uint32_t FLAG_FLOW_CONTROL = 1 << 6; // DATA ACKs advertise a receive window, see RWND_SIZE
+    static constexpr uint32_t FLAG_WINDOW = 1 << 7; // carries the window value below
+    static constexpr uint32_t FLAG_SACK = 1 << 8; // DATA ACKs report what else is held, see SACK_SIZE
+    static constexpr uint32_t FILE_FLAGS = FLAG_RESUME | FLAG_DEDUP; // flags that carry the file values below
+
+    // Checksum algorithms, as a set in the START and a single one in the ACK.
+    static constexpr uint32_t CHECKSUM_CRC32 = 1 << 0; // IEEE 802.3, see Crc32.hpp
+    static constexpr uint32_t CHECKSUM_CRC32C = 1 << 1; // Castagnoli, see Crc32c.hpp
+
+    enum Tlv : uint16_t
+    {
+        TLV_SESSION = 1,      // sessionId, stripeIndex, stripeCount, stripeOffset
+        TLV_PAYLOAD_SIZE = 2, // payloadSize
+        TLV_CHECKSUM = 3,     // checksums
+        TLV_WINDOW = 4,       // window
+        TLV_FILE = 5,         // transferId, fileSize, chunkSize, reference
+        TLV_HAVE_RUNS = 6,    // haveRuns, ACK only
+        TLV_FEC = 7,
+        TLV_COMPRESS = 8,
+        TLV_RESUME = 9,
+        TLV_DEDUP = 10,
+        TLV_BATCH = 11,
+        TLV_ZERO_RTT = 12,
+        TLV_FLOW_CONTROL = 13,
+        TLV_SACK = 14,
+        TLV_TIMESTAMPS = 15, // reserved for timestamped DATA; no endpoint offers it yet
+    };
+
+    uint16_t version = VERSION;
+    uint32_t sessionId = 0;   // shared by every flow of one transfer
+    uint32_t stripeIndex = 0; // which stripe this flow carries
+    uint32_t stripeCount = 1; // number of flows the file is split across
+    uint64_t stripeOffset = 0; // byte offset of this flow's first chunk in the output
+    uint32_t payloadSize = DEFAULT_PAYLOAD; // largest DATA payload; the ACK carries the accepted value
+    uint32_t checksums = CHECKSUM_CRC32;    // CRC32 when a peer names none
+    uint32_t flags = 0;
+
+    // With FLAG_WINDOW: the most packets the sender wants in flight per
+    // flow, and in the ACK the most the receiver will buffer, which both
+    // sides then use.
+    uint32_t window = 0;
+
+    // With FLAG_RESUME or FLAG_DEDUP. transferId (resume) and fileSize name
+    // the file, and reference (dedup) is a file in the receiver's output
+    // directory to take matching chunks from. The ACK adds the chunk size
+    // the receiver works in and the chunk runs [start, start + count) it
+    // already has.
+    uint64_t transferId = 0;
+    uint64_t fileSize = 0;
+    uint32_t chunkSize = 0;
+    std::string reference;
+    std::vector<std::pair<uint32_t, uint32_t>> haveRuns;
+
+    // With FLAG_FLOW_CONTROL every DATA ACK starts with the receiver's window
+    // in network order: how many more packets the flow may have in flight.
+    // Any other ACK payload, such as FEC's repaired marker, follows it.
+    static constexpr size_t RWND_SIZE = sizeof(uint32_t);
+
+    // With FLAG_SACK every DATA ACK then carries the flow's in-order point N,
+    // below which everything has arrived, and a bitmap whose bit i says
+    // N + 1 + i is buffered, in network order.
+    static constexpr size_t SACK_SIZE = 2 * sizeof(uint32_t);
+    static constexpr uint32_t SACK_SPAN = 32;
+
+    static constexpr size_t HEADER_SIZE = 2 * sizeof(uint32_t);
+    static constexpr size_t TLV_HEADER = 2 * sizeof(uint16_t);
+    static constexpr size_t SESSION_SIZE = 5 * sizeof(uint32_t);
+    static constexpr size_t FILE_SIZE = 5 * sizeof(uint32_t); // before the reference
+    static constexpr size_t RUN_SIZE = 2 * sizeof(uint32_t);
+    static constexpr size_t MAX_REFERENCE = 255;
+    // Runs that fit in an ACK a plain-sized receive buffer can take, next to
+    // every other TLV the ACK may carry.
+    static constexpr size_t ACK_OVERHEAD = HEADER_SIZE + 6 * TLV_HEADER + SESSION_SIZE + 3 * sizeof(uint32_t) + FILE_SIZE +
+                                           9 * TLV_HEADER;
+    static constexpr size_t MAX_RUNS = (DEFAULT_PAYLOAD - ACK_OVERHEAD) / RUN_SIZE;
+
+    std::vector<uint8_t> encode() const
+    {
+        std::vector<uint8_t> out;
+        putWord(out, MAGIC);
+        putWord(out, static_cast<uint32_t>(version) << 16);
+        putWords(out, TLV_SESSION, {sessionId, stripeIndex, stripeCount, static_cast<uint32_t>(stripeOffset >> 32),
+                                    static_cast<uint32_t>(stripeOffset)});
+        putWords(out, TLV_PAYLOAD_SIZE, {payloadSize});
+        putWords(out, TLV_CHECKSUM, {checksums});
+        if (flags & FLAG_WINDOW)
+            putWords(out, TLV_WINDOW, {window});
+        for (const auto &[flag, type] : FLAG_TLVS)
+        {
+            if (flags & flag)
+                putTlv(out, type, 0);
+        }
+        if (flags & FILE_FLAGS)
+        {
+            putTlv(out, TLV_FILE, static_cast<uint16_t>(FILE_SIZE + reference.size()));
+            for (uint32_t w : {static_cast<uint32_t>(transferId >> 32), static_cast<uint32_t>(transferId),
+                               static_cast<uint32_t>(fileSize >> 32), static_cast<uint32_t>(fileSize), chunkSize})
+                putWord(out, w);
+            out.insert(out.end(), reference.begin(), reference.end());
+            if (!haveRuns.empty())
+            {
+                putTlv(out, TLV_HAVE_RUNS, static_cast<uint16_t>(haveRuns.size() * RUN_SIZE));
+                for (const auto &[start, count] : haveRuns)
+                {
+                    putWord(out, start);
+                    putWord(out, count);
+                }
+            }
+        }
+        return out;
+    }
+
+    // Fails on a foreign payload or a TLV whose value has the wrong size;
+    // skips TLVs of unknown type.
+    bool decode(const uint8_t *data, size_t len)
+    {
+        if (len < HEADER_SIZE || word(data) != MAGIC)
+            return false;
+        uint16_t peerVersion = static_cast<uint16_t>(word(data + sizeof(uint32_t)) >> 16);
+        if (peerVersion == 0)
+            return false;
+        *this = StartOptions{};
+        version = peerVersion;
+        bool sawFile = false;
+        for (size_t at = HEADER_SIZE; at < len;)
+        {
+            if (len - at < TLV_HEADER)
+                return false;
+            uint16_t type, length;
+            memcpy(&type, data + at, sizeof(type));
+            memcpy(&length, data + at + sizeof(type), sizeof(length));
+            type = ntohs(type);
+            length = ntohs(length);
+            at += TLV_HEADER;
+            if (len - at < length || !readTlv(type, data + at, length))
+                return false;
+            sawFile |= type == TLV_FILE;
+            at += length;
+        }
+        if ((flags & FILE_FLAGS) && !sawFile)
+            return false;
+        return stripeCount > 0 && stripeIndex < stripeCount && payloadSize > 0 && payloadSize <= MAX_PAYLOAD &&
+               checksums != 0 && (!(flags & FLAG_WINDOW) || window > 0);
+    }
+
+private:
+    static constexpr std::pair<uint32_t, Tlv> FLAG_TLVS[] = {
+        {FLAG_FEC, TLV_FEC},           {FLAG_COMPRESS, TLV_COMPRESS}, {FLAG_RESUME, TLV_RESUME},
+        {FLAG_DEDUP, TLV_DEDUP},       {FLAG_BATCH, TLV_BATCH},       {FLAG_ZERO_RTT, TLV_ZERO_RTT},
+        {FLAG_FLOW_CONTROL, TLV_FLOW_CONTROL}, {FLAG_SACK, TLV_SACK},
+    };
+
+    static uint32_t word(const uint8_t *p)
+    {
+        uint32_t w;
+        memcpy(&w, p, sizeof(w));
+        return ntohl(w);
+    }
+
+    static void putWord(std::vector<uint8_t> &out, uint32_t w)
+    {
+        w = htonl(w);
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&w);
+        out.insert(out.end(), p, p + sizeof(w));
+    }
+
+    static void putTlv(std::vector<uint8_t> &out, uint16_t type, uint16_t length)
+    {
+        putWord(out, (static_cast<uint32_t>(type) << 16) | length);
+    }
+
+    static void putWords(std::vector<uint8_t> &out, uint16_t type, std::initializer_list<uint32_t> words)
+    {
+        putTlv(out, type, static_cast<uint16_t>(words.size() * sizeof(uint32_t)));
+        for (uint32_t w : words)
+            putWord(out, w);
+    }
+
+    bool readTlv(uint16_t type, const uint8_t *v, size_t length)
+    {
+        switch (type)
+        {
+        case TLV_SESSION:
+            if (length != SESSION_SIZE)
+                return false;
+            sessionId = word(v);
+            stripeIndex = word(v + 4);
+            stripeCount = word(v + 8);
+            stripeOffset = (static_cast<uint64_t>(word(v + 12)) << 32) | word(v + 16);
+            return true;
+        case TLV_PAYLOAD_SIZE:
+            if (length != sizeof(uint32_t))
+                return false;
+            payloadSize = word(v);
+            return true;
+        case TLV_CHECKSUM:
+            if (length != sizeof(uint32_t))
+                return false;
+            checksums = word(v);
+            return true;
+        case TLV_WINDOW:
+            if (length != sizeof(uint32_t))
+                return false;
+            window = word(v);
+            flags |= FLAG_WINDOW;
+            return true;
+        case TLV_FILE:
+        {
+            if (length < FILE_SIZE || length - FILE_SIZE > MAX_REFERENCE)
+                return false;
+            size_t refLen = length - FILE_SIZE;
+            transferId = (static_cast<uint64_t>(word(v)) << 32) | word(v + 4);
+            fileSize = (static_cast<uint64_t>(word(v + 8)) << 32) | word(v + 12);
+            chunkSize = word(v + 16);
+            reference.assign(reinterpret_cast<const char *>(v) + 20, refLen);
+            return true;
+        }
+        case TLV_HAVE_RUNS:
+            if (length % RUN_SIZE)
+                return false;
+            haveRuns.clear();
+            for (size_t off = 0; off < length; off += RUN_SIZE)
+                haveRuns.emplace_back(word(v + off), word(v + off + 4));
+            return true;
+        default:
+            for (const auto &[flag, t] : FLAG_TLVS)
+            {
+                if (t == type)
+                    flags |= flag;
+            }
+            return true; // a capability from a newer peer
+        }
+    }
+};
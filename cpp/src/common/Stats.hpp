@@ -0,0 +1,152 @@
+#pragma once
+
+// Transfer counters behind the --stats report. Each counter has a single
+// writer, the thread running its flow, so bumping one is a relaxed load and
+// store with no locked instruction; any thread may read it at any time,
+// which is what a report in the middle of a transfer does. SIGUSR1 only
+// raises a flag: the transfer loops poll it and write the report themselves,
+// since formatting JSON is not async-signal-safe.
+
+#include <signal.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+namespace stats
+{
+
+class Counter
+{
+public:
+    explicit Counter(uint64_t initial = 0) : v(initial) {}
+
+    void add(uint64_t n = 1)
+    {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void raiseTo(uint64_t x)
+    {
+        if (x > v.load(std::memory_order_relaxed))
+            v.store(x, std::memory_order_relaxed);
+    }
+
+    void lowerTo(uint64_t x)
+    {
+        if (x < v.load(std::memory_order_relaxed))
+            v.store(x, std::memory_order_relaxed);
+    }
+
+    void reset(uint64_t x = 0)
+    {
+        v.store(x, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const
+    {
+        return v.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> v;
+};
+
+// One flat JSON object, built field by field.
+class JsonObject
+{
+public:
+    JsonObject &field(const char *name, uint64_t value)
+    {
+        key(name);
+        out += std::to_string(value);
+        return *this;
+    }
+
+    JsonObject &field(const char *name, double value)
+    {
+        key(name);
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.6g", value);
+        out += buf;
+        return *this;
+    }
+
+    JsonObject &field(const char *name, const std::string &value)
+    {
+        key(name);
+        out += '"';
+        for (char c : value)
+        {
+            if (c == '"' || c == '\\')
+                out += '\\';
+            if (static_cast<unsigned char>(c) >= 0x20)
+                out += c;
+        }
+        out += '"';
+        return *this;
+    }
+
+    // Splices in an already formatted JSON value, e.g. a nested object.
+    JsonObject &raw(const char *name, const std::string &json)
+    {
+        key(name);
+        out += json;
+        return *this;
+    }
+
+    std::string str() const
+    {
+        return out + '}';
+    }
+
+private:
+    std::string out = "{";
+
+    void key(const char *name)
+    {
+        if (out.size() > 1)
+            out += ", ";
+        out += '"';
+        out += name;
+        out += "\": ";
+    }
+};
+
+inline volatile sig_atomic_t dumpRequested = 0;
+
+// No SA_RESTART, so a receiver blocked in recvfrom() wakes up to report.
+inline void installDumpSignal()
+{
+    struct sigaction sa{};
+    sa.sa_handler = [](int)
+    { dumpRequested = 1; };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, nullptr);
+}
+
+// True once per SIGUSR1.
+inline bool dumpPending()
+{
+    if (!dumpRequested)
+        return false;
+    dumpRequested = 0;
+    return true;
+}
+
+// Appends one report line to path, or writes it to stderr if path is empty.
+inline void write(const std::string &path, const std::string &json)
+{
+    if (path.empty())
+    {
+        fprintf(stderr, "%s\n", json.c_str());
+        fflush(stderr);
+        return;
+    }
+    std::ofstream out(path, std::ios::app);
+    out << json << '\n';
+}
+
+} // namespace stats
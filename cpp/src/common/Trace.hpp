@@ -0,0 +1,193 @@
+#pragma once
+
+// Optional event trace behind --trace, written in the Chrome Trace Event
+// JSON array format so a transfer opens directly in Perfetto or
+// chrome://tracing. Timestamps are the endpoint's steady clock in
+// microseconds, so the sender's and receiver's traces of one transfer on
+// one host line up, and a simulated transfer is traced in virtual time.
+// The array is left unterminated until close(), which both viewers accept,
+// so a trace cut short by a crash or ^C still loads.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+
+namespace trace
+{
+
+using Clock = std::chrono::steady_clock;
+
+// Process IDs of the two endpoints, so a shared trace shows them apart.
+constexpr uint32_t SENDER_PID = 1;
+constexpr uint32_t RECEIVER_PID = 2;
+
+struct Arg
+{
+    const char *name;
+    uint64_t value;
+};
+
+// One trace file. Stripe threads share it; events are buffered and written
+// in blocks under a lock.
+class Writer
+{
+public:
+    ~Writer()
+    {
+        close();
+    }
+
+    bool open(const std::string &path)
+    {
+        close();
+        out = fopen(path.c_str(), "w");
+        if (!out)
+            return false;
+        buffer = "[\n";
+        first = true;
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!out)
+            return;
+        buffer += "\n]\n";
+        flushLocked();
+        fclose(out);
+        out = nullptr;
+    }
+
+    // Writes out what is buffered, e.g. when a receiver session ends.
+    void flush()
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (out)
+            flushLocked();
+    }
+
+    void nameProcess(uint32_t pid, const std::string &name)
+    {
+        emit("{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " + std::to_string(pid) +
+             ", \"args\": {\"name\": \"" + name + "\"}}");
+    }
+
+    void nameThread(uint32_t pid, uint32_t tid, const std::string &name)
+    {
+        emit("{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " + std::to_string(pid) + ", \"tid\": " +
+             std::to_string(tid) + ", \"args\": {\"name\": \"" + name + "\"}}");
+    }
+
+    void instant(uint32_t pid, uint32_t tid, const char *name, Clock::time_point at, std::initializer_list<Arg> args)
+    {
+        emit(head(name, "i", pid, tid, at) + ", \"s\": \"t\"" + argsOf(args) + '}');
+    }
+
+    // A span that started at start and took dur, e.g. one disk write.
+    void complete(uint32_t pid, uint32_t tid, const char *name, Clock::time_point start, Clock::duration dur,
+                  std::initializer_list<Arg> args)
+    {
+        emit(head(name, "X", pid, tid, start) + ", \"dur\": " + micros(dur) + argsOf(args) + '}');
+    }
+
+    // Counters belong to a process, so each thread's gets its own name.
+    void counter(uint32_t pid, uint32_t tid, const char *name, Clock::time_point at, uint64_t value)
+    {
+        std::string series = tid ? std::string(name) + " #" + std::to_string(tid) : std::string(name);
+        emit(head(series.c_str(), "C", pid, tid, at) + argsOf({{"value", value}}) + '}');
+    }
+
+private:
+    static constexpr size_t FLUSH_AT = 1 << 16;
+
+    std::mutex lock;
+    FILE *out = nullptr;
+    std::string buffer;
+    bool first = true;
+
+    static std::string micros(Clock::duration d)
+    {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.3f", std::chrono::duration<double, std::micro>(d).count());
+        return buf;
+    }
+
+    static std::string head(const char *name, const char *phase, uint32_t pid, uint32_t tid, Clock::time_point at)
+    {
+        return std::string("{\"name\": \"") + name + "\", \"ph\": \"" + phase + "\", \"ts\": " +
+               micros(at.time_since_epoch()) + ", \"pid\": " + std::to_string(pid) + ", \"tid\": " + std::to_string(tid);
+    }
+
+    static std::string argsOf(std::initializer_list<Arg> args)
+    {
+        if (args.size() == 0)
+            return {};
+        std::string s = ", \"args\": {";
+        for (const Arg &a : args)
+        {
+            if (s.back() != '{')
+                s += ", ";
+            s += '"';
+            s += a.name;
+            s += "\": ";
+            s += std::to_string(a.value);
+        }
+        return s + '}';
+    }
+
+    void emit(const std::string &event)
+    {
+        std::lock_guard<std::mutex> guard(lock);
+        if (!out)
+            return;
+        if (!first)
+            buffer += ",\n";
+        first = false;
+        buffer += event;
+        if (buffer.size() >= FLUSH_AT)
+            flushLocked();
+    }
+
+    void flushLocked()
+    {
+        fwrite(buffer.data(), 1, buffer.size(), out);
+        fflush(out);
+        buffer.clear();
+    }
+};
+
+// Where one flow's events go: a writer and the process and thread they are
+// filed under. Tracing is off while writer is null, which is all the hot
+// paths test.
+struct Track
+{
+    Writer *writer = nullptr;
+    uint32_t pid = 0;
+    uint32_t tid = 0;
+
+    explicit operator bool() const
+    {
+        return writer != nullptr;
+    }
+
+    void instant(const char *name, Clock::time_point at, std::initializer_list<Arg> args = {}) const
+    {
+        writer->instant(pid, tid, name, at, args);
+    }
+
+    void complete(const char *name, Clock::time_point start, Clock::duration dur, std::initializer_list<Arg> args = {}) const
+    {
+        writer->complete(pid, tid, name, start, dur, args);
+    }
+
+    void counter(const char *name, Clock::time_point at, uint64_t value) const
+    {
+        writer->counter(pid, tid, name, at, value);
+    }
+};
+
+} // namespace trace
@@ -0,0 +1,90 @@
+#pragma once
+
+// The datagram and time services a WTP endpoint runs on. The binaries use
+// UdpTransport and SystemClock; the simulator (wSim) substitutes a virtual
+// network and virtual time so the same protocol code runs deterministically.
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <linux/sock_diag.h>
+#endif
+
+#include <chrono>
+#include <cstddef>
+
+class Transport
+{
+public:
+    virtual ~Transport() = default;
+
+    virtual ssize_t sendTo(const void *data, size_t len, const sockaddr_in &to) = 0;
+
+    // Waits for a datagram if wait is set; otherwise returns -1 straight away
+    // when none is queued.
+    virtual ssize_t recvFrom(void *buf, size_t cap, sockaddr_in &from, bool wait) = 0;
+
+    // Bytes of received datagrams still waiting to be read, as the kernel
+    // charges them against the receive buffer; 0 where that is unknown.
+    virtual size_t pendingBytes()
+    {
+        return 0;
+    }
+};
+
+class TimeSource
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    virtual ~TimeSource() = default;
+
+    virtual Clock::time_point now() = 0;
+};
+
+class UdpTransport : public Transport
+{
+public:
+    explicit UdpTransport(int fd) : fd(fd) {}
+
+    ssize_t sendTo(const void *data, size_t len, const sockaddr_in &to) override
+    {
+        return sendto(fd, data, len, 0, reinterpret_cast<const sockaddr *>(&to), sizeof(to));
+    }
+
+    ssize_t recvFrom(void *buf, size_t cap, sockaddr_in &from, bool wait) override
+    {
+        socklen_t len = sizeof(from);
+        return recvfrom(fd, buf, cap, wait ? 0 : MSG_DONTWAIT, reinterpret_cast<sockaddr *>(&from), &len);
+    }
+
+    size_t pendingBytes() override
+    {
+#if defined(SO_MEMINFO) && defined(__linux__)
+        uint32_t info[SK_MEMINFO_VARS] = {};
+        socklen_t len = sizeof(info);
+        if (getsockopt(fd, SOL_SOCKET, SO_MEMINFO, info, &len) == 0)
+            return info[SK_MEMINFO_RMEM_ALLOC];
+#endif
+        return 0;
+    }
+
+private:
+    int fd;
+};
+
+class SystemClock : public TimeSource
+{
+public:
+    Clock::time_point now() override
+    {
+        return Clock::now();
+    }
+
+    static SystemClock &instance()
+    {
+        static SystemClock clock;
+        return clock;
+    }
+};
@@ -0,0 +1,387 @@
+// wBench: runs real transfers over loopback through wProxy and reports how
+// each sender/receiver pair fares across a matrix of file sizes, windows,
+// loss and reorder rates. Every output file is compared with its input.
+// One row per transfer goes to the CSV and JSON reports:
+//
+// ./wBench --sizes 1024,16384 --windows 16,64 --loss 0,0.01,0.05 --csv bench.csv --json bench.json
+//
+// The binaries are looked up next to wBench (the build puts every
+// executable in bin/) unless --bin-dir says otherwise.
+
+#include <iostream>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <cxxopts.hpp>
+#include <spdlog/spdlog.h>
+
+using namespace std;
+
+using Clock = chrono::steady_clock;
+
+struct Pair
+{
+    string name;
+    string sender;
+    string receiver;
+};
+
+struct Scenario
+{
+    const Pair *pair;
+    uint64_t sizeKB;
+    int window;
+    double loss;
+    double reorder;
+    int repeat;
+};
+
+struct Outcome
+{
+    bool completed = false; // sender exited 0 within the timeout
+    bool verified = false;  // output matches the input byte for byte
+    double seconds = 0;
+    double goodputMbps = 0;
+    uint64_t dataSent = 0;   // DATA packets in the sender log
+    uint64_t dataUnique = 0; // distinct seqNums among them
+    double retransmitRatio = 0;
+    double senderCpu = 0;   // user + system seconds
+    double receiverCpu = 0;
+};
+
+class wBench
+{
+public:
+    int parseArguments(int argc, char **argv)
+    {
+        cxxopts::Options opts("wBench", "Loopback transfer benchmark matrix.");
+        opts.add_options()("sizes", "File sizes in KiB.", cxxopts::value<vector<uint64_t>>()->default_value("1024,8192"))("windows", "Window sizes.", cxxopts::value<vector<int>>()->default_value("16,64"))("loss", "Loss rates injected by wProxy.", cxxopts::value<vector<double>>()->default_value("0,0.01,0.05"))("reorder", "Reorder rates injected by wProxy.", cxxopts::value<vector<double>>()->default_value("0,0.05"))("pairs", "Which pairs to run: wSender, wSenderOpt.", cxxopts::value<vector<string>>()->default_value("wSender,wSenderOpt"))("repeat", "Runs of each scenario.", cxxopts::value<int>()->default_value("1"))("delay-ms", "One-way delay added by wProxy.", cxxopts::value<double>()->default_value("0"))("seed", "Seed for the input files and wProxy.", cxxopts::value<uint64_t>()->default_value("1"))("timeout", "Seconds before a transfer counts as failed.", cxxopts::value<int>()->default_value("300"))("bin-dir", "Directory holding the binaries; defaults to wBench's own.", cxxopts::value<string>())("work-dir", "Scratch directory for inputs, outputs and logs.", cxxopts::value<string>()->default_value(filesystem::temp_directory_path().string()))("csv", "Write the CSV report here.", cxxopts::value<string>())("json", "Write the JSON report here.", cxxopts::value<string>())("help", "Print usage.");
+
+        cxxopts::ParseResult result;
+        try
+        {
+            result = opts.parse(argc, argv);
+        }
+        catch (const exception &e)
+        {
+            cerr << "Error parsing options: " << e.what() << "\n\n"
+                 << opts.help() << "\n";
+            return 1;
+        }
+        if (result.count("help"))
+        {
+            cout << opts.help() << "\n";
+            return 1;
+        }
+
+        sizes = result["sizes"].as<vector<uint64_t>>();
+        windows = result["windows"].as<vector<int>>();
+        losses = result["loss"].as<vector<double>>();
+        reorders = result["reorder"].as<vector<double>>();
+        repeat = result["repeat"].as<int>();
+        delayMs = result["delay-ms"].as<double>();
+        seed = result["seed"].as<uint64_t>();
+        timeout = chrono::seconds(result["timeout"].as<int>());
+        workDir = filesystem::path(result["work-dir"].as<string>()) / ("wBench-" + to_string(getpid()));
+        if (result.count("csv"))
+            csvPath = result["csv"].as<string>();
+        if (result.count("json"))
+            jsonPath = result["json"].as<string>();
+
+        filesystem::path bin = result.count("bin-dir") ? filesystem::path(result["bin-dir"].as<string>())
+                                                       : filesystem::read_symlink("/proc/self/exe").parent_path();
+        proxy = (bin / "wProxy").string();
+        for (const string &p : result["pairs"].as<vector<string>>())
+        {
+            if (p == "wSender")
+                pairs.push_back({p, (bin / "wSender").string(), (bin / "wReceiver").string()});
+            else if (p == "wSenderOpt")
+                pairs.push_back({p, (bin / "wSenderOpt").string(), (bin / "wReceiverOpt").string()});
+            else
+            {
+                spdlog::error("Error: unknown pair {}\n", p);
+                return 1;
+            }
+        }
+
+        for (const Pair &p : pairs)
+        {
+            for (const string &path : {p.sender, p.receiver, proxy})
+            {
+                if (access(path.c_str(), X_OK) != 0)
+                {
+                    spdlog::error("Error: cannot run {}\n", path);
+                    return 1;
+                }
+            }
+        }
+        if (repeat < 1)
+        {
+            spdlog::error("Error: --repeat must be at least 1\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    int run()
+    {
+        filesystem::create_directories(workDir);
+        vector<Scenario> scenarios;
+        for (uint64_t size : sizes)
+            for (int window : windows)
+                for (double loss : losses)
+                    for (double reorder : reorders)
+                        for (const Pair &p : pairs)
+                            for (int r = 0; r < repeat; r++)
+                                scenarios.push_back({&p, size, window, loss, reorder, r});
+
+        vector<Outcome> outcomes;
+        int failures = 0;
+        for (size_t i = 0; i < scenarios.size(); i++)
+        {
+            const Scenario &s = scenarios[i];
+            Outcome o = transfer(s);
+            failures += !(o.completed && o.verified);
+            spdlog::info("[{}/{}] {} {} KiB w={} loss={} reorder={}: {} {:.3f} s {:.2f} Mbit/s retx {:.3f} cpu {:.3f}+{:.3f} s",
+                         i + 1, scenarios.size(), s.pair->name, s.sizeKB, s.window, s.loss, s.reorder,
+                         !o.completed ? "TIMEOUT" : o.verified ? "ok" : "MISMATCH", o.seconds, o.goodputMbps,
+                         o.retransmitRatio, o.senderCpu, o.receiverCpu);
+            outcomes.push_back(o);
+        }
+
+        if (!csvPath.empty())
+            writeCsv(scenarios, outcomes);
+        if (!jsonPath.empty())
+            writeJson(scenarios, outcomes);
+
+        error_code ec;
+        filesystem::remove_all(workDir, ec);
+        return failures ? 2 : 0;
+    }
+
+private:
+    vector<uint64_t> sizes;
+    vector<int> windows;
+    vector<double> losses;
+    vector<double> reorders;
+    vector<Pair> pairs;
+    int repeat = 1;
+    double delayMs = 0;
+    uint64_t seed = 1;
+    Clock::duration timeout{};
+    filesystem::path workDir;
+    string proxy;
+    string csvPath;
+    string jsonPath;
+    unordered_map<uint64_t, string> inputs; // size in KiB -> input file
+
+    // Asks the kernel for a free UDP port.
+    static int freePort()
+    {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t len = sizeof(addr);
+        if (fd < 0 || ::bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || getsockname(fd, (struct sockaddr *)&addr, &len) < 0)
+        {
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+        close(fd);
+        return ntohs(addr.sin_port);
+    }
+
+    // Starts argv with stdout and stderr sent to /dev/null.
+    static pid_t spawn(const vector<string> &args)
+    {
+        pid_t pid = fork();
+        if (pid != 0)
+            return pid;
+        FILE *null = freopen("/dev/null", "w", stdout);
+        (void)null;
+        dup2(STDOUT_FILENO, STDERR_FILENO);
+        vector<char *> argv;
+        for (const string &a : args)
+            argv.push_back(const_cast<char *>(a.c_str()));
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+
+    static double cpuSeconds(const rusage &ru)
+    {
+        return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+    }
+
+    // Stops a server process and returns its CPU time.
+    static double stop(pid_t pid)
+    {
+        kill(pid, SIGTERM);
+        int status;
+        rusage ru{};
+        wait4(pid, &status, 0, &ru);
+        return cpuSeconds(ru);
+    }
+
+    const string &input(uint64_t sizeKB)
+    {
+        auto it = inputs.find(sizeKB);
+        if (it != inputs.end())
+            return it->second;
+        string path = (workDir / ("input-" + to_string(sizeKB) + ".bin")).string();
+        ofstream out(path, ios::binary | ios::trunc);
+        mt19937_64 rng(seed ^ sizeKB);
+        vector<uint64_t> block(128);
+        for (uint64_t k = 0; k < sizeKB; k++)
+        {
+            for (auto &w : block)
+                w = rng();
+            out.write(reinterpret_cast<const char *>(block.data()), 1024);
+        }
+        return inputs[sizeKB] = path;
+    }
+
+    static bool sameContents(const string &a, const string &b)
+    {
+        ifstream fa(a, ios::binary), fb(b, ios::binary);
+        if (!fa || !fb)
+            return false;
+        vector<char> ba(1 << 20), bb(1 << 20);
+        while (fa && fb)
+        {
+            fa.read(ba.data(), static_cast<streamsize>(ba.size()));
+            fb.read(bb.data(), static_cast<streamsize>(bb.size()));
+            if (fa.gcount() != fb.gcount() || memcmp(ba.data(), bb.data(), static_cast<size_t>(fa.gcount())) != 0)
+                return false;
+        }
+        return fa.eof() && fb.eof();
+    }
+
+    // Counts DATA lines (<type> <seqNum> <length> <checksum>) in a sender log.
+    static void countData(const string &log, Outcome &o)
+    {
+        ifstream in(log);
+        vector<bool> seen;
+        uint32_t type, seq, length, checksum;
+        while (in >> type >> seq >> length >> checksum)
+        {
+            if (type != 2 && type != 6) // DATA, CDATA
+                continue;
+            o.dataSent++;
+            if (seq >= seen.size())
+                seen.resize(max<size_t>(seq + 1, seen.size() * 2));
+            if (!seen[seq])
+            {
+                seen[seq] = true;
+                o.dataUnique++;
+            }
+        }
+        o.retransmitRatio = o.dataUnique ? static_cast<double>(o.dataSent - o.dataUnique) / o.dataUnique : 0;
+    }
+
+    Outcome transfer(const Scenario &s)
+    {
+        Outcome o;
+        filesystem::path dir = workDir / "run";
+        error_code ec;
+        filesystem::remove_all(dir, ec);
+        filesystem::create_directories(dir);
+        const string &in = input(s.sizeKB);
+        string window = to_string(s.window);
+        int receiverPort = freePort();
+        int proxyPort = freePort();
+
+        pid_t receiver = spawn({s.pair->receiver, "-p", to_string(receiverPort), "-w", window, "-d", dir.string(), "-o", (dir / "receiver.out").string()});
+        pid_t relay = spawn({proxy, "-p", to_string(proxyPort), "-t", to_string(receiverPort), "--loss", to_string(s.loss), "--reorder", to_string(s.reorder), "--delay-ms", to_string(delayMs), "--seed", to_string(seed + s.repeat)});
+        this_thread::sleep_for(chrono::milliseconds(200));
+
+        Clock::time_point start = Clock::now();
+        pid_t sender = spawn({s.pair->sender, "-h", "127.0.0.1", "-p", to_string(proxyPort), "-w", window, "-i", in, "-o", (dir / "sender.out").string()});
+        int status = 0;
+        rusage ru{};
+        while (wait4(sender, &status, WNOHANG, &ru) == 0)
+        {
+            if (Clock::now() - start > timeout)
+            {
+                kill(sender, SIGKILL);
+                wait4(sender, &status, 0, &ru);
+                break;
+            }
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        o.seconds = chrono::duration<double>(Clock::now() - start).count();
+        o.completed = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        o.senderCpu = cpuSeconds(ru);
+
+        // Let the receiver finish writing before it is stopped.
+        this_thread::sleep_for(chrono::milliseconds(100));
+        o.receiverCpu = stop(receiver);
+        stop(relay);
+
+        o.verified = sameContents(in, (dir / "FILE-0.out").string());
+        o.goodputMbps = o.seconds > 0 ? s.sizeKB * 1024 * 8 / o.seconds / 1e6 : 0;
+        countData((dir / "sender.out").string(), o);
+        return o;
+    }
+
+    void writeCsv(const vector<Scenario> &scenarios, const vector<Outcome> &outcomes) const
+    {
+        ofstream out(csvPath, ios::trunc);
+        out << "pair,size_kb,window,loss,reorder,repeat,completed,verified,seconds,goodput_mbps,data_sent,data_unique,retransmit_ratio,sender_cpu_s,receiver_cpu_s\n";
+        for (size_t i = 0; i < scenarios.size(); i++)
+        {
+            const Scenario &s = scenarios[i];
+            const Outcome &o = outcomes[i];
+            out << s.pair->name << ',' << s.sizeKB << ',' << s.window << ',' << s.loss << ',' << s.reorder << ',' << s.repeat << ','
+                << o.completed << ',' << o.verified << ',' << o.seconds << ',' << o.goodputMbps << ',' << o.dataSent << ','
+                << o.dataUnique << ',' << o.retransmitRatio << ',' << o.senderCpu << ',' << o.receiverCpu << '\n';
+        }
+    }
+
+    void writeJson(const vector<Scenario> &scenarios, const vector<Outcome> &outcomes) const
+    {
+        ofstream out(jsonPath, ios::trunc);
+        out << "[\n";
+        for (size_t i = 0; i < scenarios.size(); i++)
+        {
+            const Scenario &s = scenarios[i];
+            const Outcome &o = outcomes[i];
+            out << "  {\"pair\": \"" << s.pair->name << "\", \"size_kb\": " << s.sizeKB << ", \"window\": " << s.window
+                << ", \"loss\": " << s.loss << ", \"reorder\": " << s.reorder << ", \"repeat\": " << s.repeat
+                << ", \"completed\": " << (o.completed ? "true" : "false") << ", \"verified\": " << (o.verified ? "true" : "false")
+                << ", \"seconds\": " << o.seconds << ", \"goodput_mbps\": " << o.goodputMbps << ", \"data_sent\": " << o.dataSent
+                << ", \"data_unique\": " << o.dataUnique << ", \"retransmit_ratio\": " << o.retransmitRatio
+                << ", \"sender_cpu_s\": " << o.senderCpu << ", \"receiver_cpu_s\": " << o.receiverCpu << '}'
+                << (i + 1 < scenarios.size() ? ",\n" : "\n");
+        }
+        out << "]\n";
+    }
+};
+
+int main(int argc, char **argv)
+{
+    ios_base::sync_with_stdio(false);
+    spdlog::set_level(spdlog::level::info);
+
+    wBench bench;
+    if (bench.parseArguments(argc, argv))
+        return 1;
+    return bench.run();
+}
@@ -0,0 +1,568 @@
+// wLogAnalyze: turns the "<type> <seqNum> <length> <checksum>" logs both
+// endpoints write into a summary report. Logs are mapped rather than read
+// and are parsed in one pass front to back, dropping pages behind the
+// cursor, so multi-GB logs from a long transfer need no more memory than a
+// counter per sequence number.
+//
+// For each log the report gives the packets by type, how often each DATA
+// seqNum was sent (or arrived), the bytes spent on repeats, duplicate ACKs
+// and their runs, the longest stretch of DATA during which the window did
+// not move, and the window's in-order point sampled across the log. Given
+// both logs of a transfer it also estimates loss in each direction. The
+// report is plain text in a fixed layout, so two runs can be diffed.
+//
+// wSenderOpt ACKs each packet it gets and wSender's receiver ACKs the next
+// seqNum it expects; the two are told apart from the log unless --acks says.
+//
+// ./wLogAnalyze -s sender.out -r receiver.out --top 5
+
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cxxopts.hpp>
+#include <spdlog/spdlog.h>
+
+using namespace std;
+
+enum : uint32_t
+{
+    START = 0,
+    END = 1,
+    DATA = 2,
+    ACK = 3,
+    PROBE = 4,
+    FEC = 5,
+    CDATA = 6,
+    MANIFEST = 7,
+    TYPE_COUNT = 8
+};
+static const char *const TYPE_NAMES[TYPE_COUNT] = {"START", "END", "DATA", "ACK", "PROBE", "FEC", "CDATA", "MANIFEST"};
+static constexpr uint64_t HEADER_BYTES = 16;
+
+// Sequence numbers above this are not taken for DATA, so a damaged line
+// cannot make the per-seq tables huge.
+static constexpr uint32_t MAX_DATA_SEQ = 1u << 28;
+
+// A whole file mapped read-only.
+class MappedFile
+{
+public:
+    ~MappedFile()
+    {
+        if (data && size)
+            munmap(const_cast<char *>(data), size);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    bool open(const string &path)
+    {
+        fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st{};
+        if (fd < 0 || fstat(fd, &st) < 0)
+            return false;
+        size = static_cast<size_t>(st.st_size);
+        if (size == 0)
+            return true;
+        void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED)
+            return false;
+        data = static_cast<const char *>(p);
+        madvise(p, size, MADV_SEQUENTIAL);
+        return true;
+    }
+
+    // Gives back the pages below offset, which the parser is done with.
+    void release(size_t offset)
+    {
+        size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size_t upTo = offset / page * page;
+        if (upTo > released)
+        {
+            madvise(const_cast<char *>(data) + released, upTo - released, MADV_DONTNEED);
+            released = upTo;
+        }
+    }
+
+    const char *data = nullptr;
+    size_t size = 0;
+
+private:
+    int fd = -1;
+    size_t released = 0;
+};
+
+struct LogLine
+{
+    uint32_t type, seqNum, length, checksum;
+};
+
+// Parses the line at p and moves p past it. Returns false for a line that
+// is not four unsigned 32-bit numbers.
+static bool parseLine(const char *&p, const char *end, LogLine &line)
+{
+    uint32_t *fields[] = {&line.type, &line.seqNum, &line.length, &line.checksum};
+    bool ok = true;
+    for (uint32_t *field : fields)
+    {
+        while (p < end && *p == ' ')
+            p++;
+        uint64_t v = 0;
+        const char *digits = p;
+        while (p < end && *p >= '0' && *p <= '9' && p - digits < 11)
+            v = v * 10 + static_cast<uint64_t>(*p++ - '0');
+        ok = ok && p > digits && v <= UINT32_MAX;
+        *field = static_cast<uint32_t>(v);
+    }
+    while (p < end && *p == ' ')
+        p++;
+    ok = ok && (p == end || *p == '\n' || *p == '\r');
+    const char *eol = static_cast<const char *>(memchr(p, '\n', static_cast<size_t>(end - p)));
+    p = eol ? eol + 1 : end;
+    return ok;
+}
+
+// How ACK seqNums are read: the packet acknowledged, or the next one expected.
+enum class AckMode
+{
+    Selective,
+    Cumulative
+};
+
+// What one log says, worked out under both ACK readings at once; the report
+// picks one at the end.
+struct LogSummary
+{
+    string path;
+    uint64_t lines = 0, unparsed = 0;
+    uint64_t byType[TYPE_COUNT] = {};
+    uint64_t otherTypes = 0;
+    uint64_t sessions = 0;
+
+    uint64_t dataPackets = 0, repeats = 0, distinctSeqs = 0;
+    uint64_t dataBytes = 0, wastedBytes = 0;
+    vector<uint64_t> sendsHistogram; // [n]: seqNums sent n times
+    struct Hot
+    {
+        uint64_t session;
+        uint32_t seq, sends;
+    };
+    vector<Hot> hottest; // most repeated seqNums, best first
+
+    uint64_t acks = 0, handshakeAcks = 0;
+    uint64_t cumulativeVotes = 0; // sessions whose ACKs ran past the last DATA seqNum
+
+    struct PerMode
+    {
+        uint64_t duplicateAcks = 0, runs = 0, longestRun = 0, currentRun = 0;
+        uint64_t stall = 0, longestStall = 0, stallLine = 0, longestStallLine = 0;
+        uint32_t stallSeq = 0, longestStallSeq = 0;
+        uint64_t ackedBase = 0; // in-order points of the sessions before this one, summed
+        uint32_t ackedThrough = 0;
+        uint64_t total() const
+        {
+            return ackedBase + ackedThrough;
+        }
+    };
+    PerMode modes[2]; // indexed by AckMode
+
+    struct Sample
+    {
+        unsigned percent;
+        uint64_t line, dataPackets, repeats;
+        uint64_t ackedThrough[2];
+    };
+    vector<Sample> timeline;
+};
+
+class LogAnalyzer
+{
+public:
+    size_t topCount = 10;
+    unsigned timelinePoints = 20;
+    ofstream *perSeq = nullptr; // --per-seq
+
+    bool analyze(const string &path, LogSummary &out)
+    {
+        MappedFile file;
+        if (!file.open(path))
+        {
+            spdlog::error("Cannot map {}: {}", path, strerror(errno));
+            return false;
+        }
+        s = &out;
+        s->path = path;
+        inSession = false;
+        startSession(UINT32_MAX);
+
+        const char *begin = file.data, *end = file.data + file.size, *p = begin;
+        unsigned nextPoint = 1;
+        constexpr size_t RELEASE_STEP = 64 << 20;
+        size_t releasedAt = 0;
+        LogLine line{};
+        while (p < end)
+        {
+            s->lines++;
+            if (parseLine(p, end, line))
+                account(line);
+            else
+                s->unparsed++;
+            size_t offset = static_cast<size_t>(p - begin);
+            while (nextPoint <= timelinePoints && offset * timelinePoints >= file.size * nextPoint)
+                sample(100 * nextPoint++ / timelinePoints);
+            if (offset - releasedAt >= RELEASE_STEP)
+            {
+                file.release(offset);
+                releasedAt = offset;
+            }
+        }
+        closeSession();
+        while (nextPoint <= timelinePoints)
+            sample(100 * nextPoint++ / timelinePoints);
+        return true;
+    }
+
+private:
+    LogSummary *s = nullptr;
+
+    // The session the lines belong to, from its START on.
+    uint32_t startSeq = UINT32_MAX;
+    bool inSession = false;
+    vector<uint32_t> sends;
+    vector<bool> acked;
+    uint32_t maxDataSeq = 0, maxAck = 0;
+    bool anyData = false, anyAck = false;
+    uint32_t lastAck = 0;
+
+    void startSession(uint32_t seq)
+    {
+        startSeq = seq;
+        sends.clear();
+        acked.clear();
+        maxDataSeq = maxAck = lastAck = 0;
+        anyData = anyAck = false;
+        for (auto &m : s->modes)
+        {
+            m.ackedThrough = 0;
+            m.currentRun = 0;
+        }
+    }
+
+    void closeSession()
+    {
+        if (!anyData && !anyAck)
+            return;
+        if (anyData && anyAck && maxAck > maxDataSeq)
+            s->cumulativeVotes++;
+        for (uint32_t seq = 0; seq < sends.size(); seq++)
+        {
+            uint32_t n = sends[seq];
+            if (n == 0)
+                continue;
+            s->distinctSeqs++;
+            if (s->sendsHistogram.size() <= n)
+                s->sendsHistogram.resize(n + 1);
+            s->sendsHistogram[n]++;
+            if (n > 1)
+                rememberHot(seq, n);
+            if (perSeq)
+                *perSeq << s->sessions << ',' << seq << ',' << n << '\n';
+        }
+        for (auto &m : s->modes)
+            m.ackedBase += m.ackedThrough;
+        s->sessions++;
+    }
+
+    void rememberHot(uint32_t seq, uint32_t n)
+    {
+        auto better = [](const LogSummary::Hot &a, const LogSummary::Hot &b)
+        { return a.sends != b.sends ? a.sends > b.sends : make_pair(a.session, a.seq) < make_pair(b.session, b.seq); };
+        LogSummary::Hot hot{s->sessions, seq, n};
+        if (s->hottest.size() == topCount && !better(hot, s->hottest.back()))
+            return;
+        s->hottest.insert(upper_bound(s->hottest.begin(), s->hottest.end(), hot, better), hot);
+        if (s->hottest.size() > topCount)
+            s->hottest.pop_back();
+    }
+
+    void account(const LogLine &line)
+    {
+        if (line.type < TYPE_COUNT)
+            s->byType[line.type]++;
+        else
+            s->otherTypes++;
+
+        switch (line.type)
+        {
+        case START:
+            // A retransmitted START carries the same seqNum; a new one starts a session.
+            if (!inSession || line.seqNum != startSeq)
+            {
+                if (inSession || anyData || anyAck)
+                    closeSession();
+                startSession(line.seqNum);
+                inSession = true;
+            }
+            break;
+        case DATA:
+        case CDATA:
+            onData(line);
+            break;
+        case ACK:
+            onAck(line.seqNum);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void onData(const LogLine &line)
+    {
+        s->dataPackets++;
+        s->dataBytes += HEADER_BYTES + line.length;
+        for (auto &m : s->modes)
+        {
+            if (m.stall++ == 0)
+            {
+                m.stallLine = s->lines;
+                m.stallSeq = m.ackedThrough;
+            }
+        }
+        if (line.seqNum >= MAX_DATA_SEQ)
+            return;
+        if (sends.size() <= line.seqNum)
+            sends.resize(max<size_t>(line.seqNum + 1, sends.size() * 2));
+        if (sends[line.seqNum]++ > 0)
+        {
+            s->repeats++;
+            s->wastedBytes += HEADER_BYTES + line.length;
+        }
+        maxDataSeq = max(maxDataSeq, line.seqNum);
+        anyData = true;
+    }
+
+    void onAck(uint32_t seq)
+    {
+        s->acks++;
+        // START and END are ACKed with the START seqNum, which can collide
+        // with a DATA seqNum of a long transfer.
+        if (inSession && seq == startSeq && (seq >= sends.size() || sends[seq] == 0))
+        {
+            s->handshakeAcks++;
+            return;
+        }
+        if (seq >= MAX_DATA_SEQ)
+            return;
+
+        // Selective: a duplicate repeats an ACK already seen; the in-order
+        // point is the first seqNum not yet acknowledged.
+        if (acked.size() <= seq)
+            acked.resize(max<size_t>(seq + 1, acked.size() * 2));
+        LogSummary::PerMode &sel = s->modes[static_cast<int>(AckMode::Selective)];
+        countDuplicate(sel, acked[seq]);
+        acked[seq] = true;
+        uint32_t through = sel.ackedThrough;
+        while (through < acked.size() && acked[through])
+            through++;
+        advance(sel, through);
+
+        // Cumulative: a duplicate repeats the previous ACK, which names the
+        // in-order point itself.
+        LogSummary::PerMode &cum = s->modes[static_cast<int>(AckMode::Cumulative)];
+        countDuplicate(cum, anyAck && seq == lastAck);
+        advance(cum, max(cum.ackedThrough, seq));
+
+        lastAck = seq;
+        maxAck = anyAck ? max(maxAck, seq) : seq;
+        anyAck = true;
+    }
+
+    static void countDuplicate(LogSummary::PerMode &m, bool duplicate)
+    {
+        if (!duplicate)
+        {
+            m.currentRun = 0;
+            return;
+        }
+        m.duplicateAcks++;
+        if (m.currentRun++ == 0)
+            m.runs++;
+        m.longestRun = max(m.longestRun, m.currentRun);
+    }
+
+    static void advance(LogSummary::PerMode &m, uint32_t through)
+    {
+        if (through == m.ackedThrough)
+            return;
+        m.ackedThrough = through;
+        if (m.stall > m.longestStall)
+        {
+            m.longestStall = m.stall;
+            m.longestStallLine = m.stallLine;
+            m.longestStallSeq = m.stallSeq;
+        }
+        m.stall = 0;
+    }
+
+    void sample(unsigned percent)
+    {
+        LogSummary::Sample point{percent, s->lines, s->dataPackets, s->repeats, {}};
+        for (int i = 0; i < 2; i++)
+            point.ackedThrough[i] = s->modes[i].total();
+        s->timeline.push_back(point);
+    }
+};
+
+static double percentOf(uint64_t part, uint64_t whole)
+{
+    return whole ? 100.0 * static_cast<double>(part) / static_cast<double>(whole) : 0.0;
+}
+
+static void printSummary(const LogSummary &s, const char *role, AckMode forced, bool autoMode)
+{
+    AckMode mode = autoMode ? (s.cumulativeVotes ? AckMode::Cumulative : AckMode::Selective) : forced;
+    const LogSummary::PerMode &m = s.modes[static_cast<int>(mode)];
+    bool sender = strcmp(role, "sender") == 0;
+    const char *repeats = sender ? "retransmits" : "duplicate data";
+
+    printf("== %s (%s)\n", s.path.c_str(), role);
+    printf("%-22s %llu\n", "lines", static_cast<unsigned long long>(s.lines));
+    printf("%-22s %llu\n", "unparsed lines", static_cast<unsigned long long>(s.unparsed));
+    printf("%-22s %llu\n", "sessions", static_cast<unsigned long long>(s.sessions));
+    printf("%-22s", "packets");
+    for (uint32_t t = 0; t < TYPE_COUNT; t++)
+        if (s.byType[t])
+            printf(" %s %llu", TYPE_NAMES[t], static_cast<unsigned long long>(s.byType[t]));
+    if (s.otherTypes)
+        printf(" other %llu", static_cast<unsigned long long>(s.otherTypes));
+    printf("\n");
+    printf("%-22s %llu (%llu distinct seqNums, %llu bytes)\n", "data packets", static_cast<unsigned long long>(s.dataPackets),
+           static_cast<unsigned long long>(s.distinctSeqs), static_cast<unsigned long long>(s.dataBytes));
+    printf("%-22s %llu (%.3f%% of data packets)\n", repeats, static_cast<unsigned long long>(s.repeats), percentOf(s.repeats, s.dataPackets));
+    printf("%-22s %llu (%.3f%% of data bytes)\n", "wasted bytes", static_cast<unsigned long long>(s.wastedBytes), percentOf(s.wastedBytes, s.dataBytes));
+    printf("%-22s", sender ? "sends per seqNum" : "arrivals per seqNum");
+    for (size_t n = 1; n < s.sendsHistogram.size(); n++)
+        if (s.sendsHistogram[n])
+            printf(" %zux%llu", n, static_cast<unsigned long long>(s.sendsHistogram[n]));
+    printf("\n");
+    printf("%-22s", "most repeated");
+    for (const auto &hot : s.hottest)
+    {
+        if (s.sessions > 1)
+            printf(" %llu/", static_cast<unsigned long long>(hot.session));
+        else
+            printf(" ");
+        printf("%u:%u", hot.seq, hot.sends);
+    }
+    printf("%s\n", s.hottest.empty() ? " none" : "");
+    printf("%-22s %s%s\n", "ack mode", mode == AckMode::Selective ? "selective" : "cumulative", autoMode ? " (detected)" : "");
+    printf("%-22s %llu (%llu handshake)\n", "acks", static_cast<unsigned long long>(s.acks), static_cast<unsigned long long>(s.handshakeAcks));
+    printf("%-22s %llu in %llu runs, longest %llu\n", "duplicate acks", static_cast<unsigned long long>(m.duplicateAcks),
+           static_cast<unsigned long long>(m.runs), static_cast<unsigned long long>(m.longestRun));
+    uint64_t stall = m.longestStall, stallLine = m.longestStallLine;
+    uint32_t stallSeq = m.longestStallSeq;
+    if (m.stall > stall) // the log ended in a stall
+    {
+        stall = m.stall;
+        stallLine = m.stallLine;
+        stallSeq = m.stallSeq;
+    }
+    if (stall)
+        printf("%-22s %llu data packets from line %llu, waiting for seqNum %u\n", "longest stall",
+               static_cast<unsigned long long>(stall), static_cast<unsigned long long>(stallLine), stallSeq);
+    else
+        printf("%-22s none\n", "longest stall");
+
+    printf("window timeline\n");
+    printf("%8s %14s %14s %12s %14s\n", "log %", "line", "data", sender ? "retx" : "dups", "in order");
+    int idx = static_cast<int>(mode);
+    for (const auto &point : s.timeline)
+        printf("%8u %14llu %14llu %12llu %14llu\n", point.percent, static_cast<unsigned long long>(point.line),
+               static_cast<unsigned long long>(point.dataPackets), static_cast<unsigned long long>(point.repeats),
+               static_cast<unsigned long long>(point.ackedThrough[idx]));
+}
+
+// Both logs of one transfer: what left one end and never showed up in the
+// other's log. The receiver only logs DATA that passed its checksum, so
+// corrupted packets count as lost.
+static void printLoss(const LogSummary &sender, const LogSummary &receiver)
+{
+    uint64_t sent = sender.dataPackets, got = receiver.dataPackets;
+    uint64_t acksSent = receiver.byType[ACK], acksGot = sender.byType[ACK];
+    printf("== loss\n");
+    printf("%-22s %.3f%% (%llu of %llu arrived)\n", "data", percentOf(sent - min(sent, got), sent),
+           static_cast<unsigned long long>(got), static_cast<unsigned long long>(sent));
+    printf("%-22s %.3f%% (%llu of %llu arrived)\n", "acks", percentOf(acksSent - min(acksSent, acksGot), acksSent),
+           static_cast<unsigned long long>(acksGot), static_cast<unsigned long long>(acksSent));
+}
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options opts("wLogAnalyze", "Summarizes wSender and wReceiver logs for comparing runs.");
+    opts.add_options()("s,sender-log", "Log written by the sender (-o of wSender).", cxxopts::value<string>()->default_value(""))("r,receiver-log", "Log written by the receiver of the same transfer.", cxxopts::value<string>()->default_value(""))("acks", "How ACK seqNums are read: auto, selective (wReceiverOpt) or cumulative (wReceiver).", cxxopts::value<string>()->default_value("auto"))("top", "How many of the most repeated seqNums to list.", cxxopts::value<size_t>()->default_value("10"))("timeline", "Points in the window timeline.", cxxopts::value<unsigned>()->default_value("20"))("per-seq", "Also write session,seqNum,sends for every DATA seqNum of the sender log to this CSV file.", cxxopts::value<string>()->default_value(""))("help", "Print usage.");
+
+    cxxopts::ParseResult result;
+    try
+    {
+        result = opts.parse(argc, argv);
+    }
+    catch (const exception &e)
+    {
+        cerr << "Error parsing options: " << e.what() << "\n\n"
+             << opts.help() << "\n";
+        return 1;
+    }
+    string senderLog = result["sender-log"].as<string>();
+    string receiverLog = result["receiver-log"].as<string>();
+    string acks = result["acks"].as<string>();
+    if (result.count("help") || (senderLog.empty() && receiverLog.empty()))
+    {
+        cout << opts.help() << "\n";
+        return result.count("help") ? 0 : 1;
+    }
+    if (acks != "auto" && acks != "selective" && acks != "cumulative")
+    {
+        spdlog::error("Error: --acks must be auto, selective or cumulative");
+        return 1;
+    }
+    bool autoMode = acks == "auto";
+    AckMode mode = acks == "cumulative" ? AckMode::Cumulative : AckMode::Selective;
+
+    LogAnalyzer analyzer;
+    analyzer.topCount = result["top"].as<size_t>();
+    analyzer.timelinePoints = max(1u, result["timeline"].as<unsigned>());
+
+    ofstream perSeq;
+    string perSeqPath = result["per-seq"].as<string>();
+    LogSummary senderSummary, receiverSummary;
+    if (!senderLog.empty())
+    {
+        if (!perSeqPath.empty())
+        {
+            perSeq.open(perSeqPath, ios::out | ios::trunc);
+            perSeq << "session,seq,sends\n";
+            analyzer.perSeq = &perSeq;
+        }
+        if (!analyzer.analyze(senderLog, senderSummary))
+            return 1;
+        analyzer.perSeq = nullptr;
+        printSummary(senderSummary, "sender", mode, autoMode);
+    }
+    if (!receiverLog.empty())
+    {
+        if (!analyzer.analyze(receiverLog, receiverSummary))
+            return 1;
+        printSummary(receiverSummary, "receiver", mode, autoMode);
+    }
+    if (!senderLog.empty() && !receiverLog.empty())
+        printLoss(senderSummary, receiverSummary);
+    return 0;
+}
@@ -0,0 +1,377 @@
+// wProxy: a UDP relay that misbehaves on purpose, standing in for netem on
+// loopback. Put it between a sender and a receiver:
+//
+// ./wReceiverOpt -p 9000 -w 16 -d out -o receiver.out
+// ./wProxy -p 8000 -t 9000 --loss 0.02 --reorder 0.05 --delay-ms 10
+// ./wSenderOpt -h 127.0.0.1 -p 8000 -w 16 -i file -o sender.out
+//
+// Every client address gets its own upstream socket, so the receiver still
+// sees one source address per flow (striped senders keep working) and its
+// replies find their way back. Impairments apply to both directions, and
+// all randomness comes from --seed.
+
+#include <iostream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <vector>
+#include <cxxopts.hpp>
+#include <spdlog/spdlog.h>
+
+using namespace std;
+
+using Clock = chrono::steady_clock;
+
+static volatile sig_atomic_t stopRequested = 0;
+
+class wProxy
+{
+public:
+    int listenPort;
+    int targetPort;
+    string targetHost;
+    double loss = 0;
+    double dup = 0;
+    double reorder = 0;
+    double corrupt = 0;
+    Clock::duration delay{};
+    Clock::duration jitter{};
+    double bitsPerSecond = 0;
+    size_t queueLimit = 0;
+
+    ~wProxy()
+    {
+        for (auto &[key, fd] : upstream)
+            close(fd);
+        if (front >= 0)
+            close(front);
+    }
+
+    int parseArguments(int argc, char **argv)
+    {
+        cxxopts::Options opts("wProxy", "Lossy UDP relay for loopback tests.");
+        opts.add_options()("p,port", "Port wProxy listens on for senders.", cxxopts::value<int>())("h,host", "Host the receiver runs on.", cxxopts::value<string>()->default_value("127.0.0.1"))("t,target-port", "Port the receiver listens on.", cxxopts::value<int>())("loss", "Chance each datagram is dropped.", cxxopts::value<double>()->default_value("0"))("dup", "Chance each datagram is delivered twice.", cxxopts::value<double>()->default_value("0"))("reorder", "Chance each datagram is held back by up to --jitter-ms.", cxxopts::value<double>()->default_value("0"))("corrupt", "Chance one byte of a datagram is flipped.", cxxopts::value<double>()->default_value("0"))("delay-ms", "Delay added to every datagram.", cxxopts::value<double>()->default_value("0"))("jitter-ms", "Longest hold-back of a reordered datagram.", cxxopts::value<double>()->default_value("5"))("rate-mbps", "Bandwidth limit in Mbit/s each way; 0 for none.", cxxopts::value<double>()->default_value("0"))("queue", "Datagrams the rate limiter may queue per direction before dropping.", cxxopts::value<size_t>()->default_value("1000"))("seed", "Seed for the impairments.", cxxopts::value<uint64_t>()->default_value("1"))("help", "Print usage.");
+        // ./wProxy -p 8000 -t 9000 --loss 0.05 --dup 0.01 --reorder 0.1 --delay-ms 20 --rate-mbps 100
+
+        cxxopts::ParseResult result;
+        try
+        {
+            result = opts.parse(argc, argv);
+        }
+        catch (const exception &e)
+        {
+            cerr << "Error parsing options: " << e.what() << "\n\n"
+                 << opts.help() << "\n";
+            return 1;
+        }
+
+        if (result.count("help"))
+        {
+            cout << opts.help() << "\n";
+            return 1;
+        }
+
+        if (!result.count("port") || !result.count("target-port"))
+        {
+            cerr << "Error: Missing required arguments\n\n"
+                 << opts.help() << "\n";
+            return 1;
+        }
+
+        listenPort = result["port"].as<int>();
+        targetPort = result["target-port"].as<int>();
+        targetHost = result["host"].as<string>();
+        loss = result["loss"].as<double>();
+        dup = result["dup"].as<double>();
+        reorder = result["reorder"].as<double>();
+        corrupt = result["corrupt"].as<double>();
+        delay = millis(result["delay-ms"].as<double>());
+        jitter = millis(result["jitter-ms"].as<double>());
+        bitsPerSecond = result["rate-mbps"].as<double>() * 1e6;
+        queueLimit = result["queue"].as<size_t>();
+        rng.seed(result["seed"].as<uint64_t>());
+
+        for (int p : {listenPort, targetPort})
+        {
+            if (p < 1024 || p > 65535)
+            {
+                spdlog::error("Error: port number must be in the range of [1024, 65535]\n");
+                return 1;
+            }
+        }
+        for (double p : {loss, dup, reorder, corrupt})
+        {
+            if (p < 0 || p > 1)
+            {
+                spdlog::error("Error: probabilities must be in the range of [0, 1]\n");
+                return 1;
+            }
+        }
+
+        memset(&target, 0, sizeof(target));
+        target.sin_family = AF_INET;
+        target.sin_port = htons(targetPort);
+        if (inet_pton(AF_INET, targetHost.c_str(), &target.sin_addr) != 1)
+        {
+            spdlog::error("Error: {} is not an IPv4 address\n", targetHost);
+            return 1;
+        }
+        return 0;
+    }
+
+    int bindSocket()
+    {
+        front = socket(AF_INET, SOCK_DGRAM, 0);
+        if (front < 0)
+        {
+            perror("socket creation failed");
+            return 1;
+        }
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = INADDR_ANY;
+        addr.sin_port = htons(listenPort);
+        if (::bind(front, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+        {
+            perror("bind failed");
+            return 1;
+        }
+        growBuffers(front);
+        spdlog::info("Relaying port {} to {}:{}", listenPort, targetHost, targetPort);
+        return 0;
+    }
+
+    void run()
+    {
+        vector<uint8_t> buf(65536);
+        vector<pollfd> fds;
+        vector<sockaddr_in> owners; // client behind fds[i] for i > 0
+        while (!stopRequested)
+        {
+            fds.assign(1, pollfd{front, POLLIN, 0});
+            owners.assign(1, sockaddr_in{});
+            for (auto &[key, fd] : upstream)
+            {
+                fds.push_back(pollfd{fd, POLLIN, 0});
+                owners.push_back(clients[key]);
+            }
+
+            int timeout = -1;
+            if (!pending.empty())
+            {
+                auto wait = chrono::duration_cast<chrono::microseconds>(pending.top().at - Clock::now()).count();
+                timeout = static_cast<int>(max<int64_t>(0, (wait + 999) / 1000));
+            }
+            if (poll(fds.data(), fds.size(), timeout) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                perror("poll failed");
+                return;
+            }
+
+            for (size_t i = 0; i < fds.size(); i++)
+            {
+                if (!(fds[i].revents & POLLIN))
+                    continue;
+                sockaddr_in from{};
+                socklen_t len = sizeof(from);
+                ssize_t n;
+                while ((n = recvfrom(fds[i].fd, buf.data(), buf.size(), MSG_DONTWAIT, (struct sockaddr *)&from, &len)) >= 0)
+                {
+                    if (i == 0)
+                        relay(forward, upstreamFor(from), target, buf.data(), n);
+                    else
+                        relay(backward, front, owners[i], buf.data(), n);
+                    len = sizeof(from);
+                }
+            }
+            flushDue();
+        }
+        report();
+    }
+
+private:
+    // One direction of the relay.
+    struct Link
+    {
+        Clock::time_point busyUntil{};
+        size_t queued = 0;
+        uint64_t datagrams = 0;
+        uint64_t dropped = 0;
+        uint64_t overflowed = 0;
+        uint64_t duplicated = 0;
+        uint64_t reordered = 0;
+        uint64_t corrupted = 0;
+    };
+
+    struct Datagram
+    {
+        Clock::time_point at;
+        uint64_t order; // FIFO among datagrams due at the same time
+        int fd;
+        sockaddr_in to;
+        Link *link;
+        vector<uint8_t> bytes;
+
+        bool operator>(const Datagram &o) const
+        {
+            return at != o.at ? at > o.at : order > o.order;
+        }
+    };
+
+    int front = -1;
+    sockaddr_in target{};
+    map<uint64_t, int> upstream;          // client address -> socket toward the receiver
+    map<uint64_t, sockaddr_in> clients;
+    priority_queue<Datagram, vector<Datagram>, greater<Datagram>> pending;
+    uint64_t order = 0;
+    Link forward;
+    Link backward;
+    mt19937_64 rng;
+    uniform_real_distribution<double> uniform{0.0, 1.0};
+
+    static Clock::duration millis(double v)
+    {
+        return chrono::duration_cast<Clock::duration>(chrono::duration<double, milli>(v));
+    }
+
+    static uint64_t addrKey(const sockaddr_in &a)
+    {
+        return (static_cast<uint64_t>(a.sin_addr.s_addr) << 16) | a.sin_port;
+    }
+
+    static void growBuffers(int fd)
+    {
+        int size = 4 << 20;
+        setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+        setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    }
+
+    bool chance(double p)
+    {
+        return p > 0 && uniform(rng) < p;
+    }
+
+    int upstreamFor(const sockaddr_in &client)
+    {
+        uint64_t key = addrKey(client);
+        auto it = upstream.find(key);
+        if (it != upstream.end())
+            return it->second;
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0)
+        {
+            perror("socket creation failed");
+            return -1;
+        }
+        growBuffers(fd);
+        upstream[key] = fd;
+        clients[key] = client;
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client.sin_addr, ip, sizeof(ip));
+        spdlog::info("New client {}:{}", ip, ntohs(client.sin_port));
+        return fd;
+    }
+
+    void relay(Link &link, int fd, const sockaddr_in &to, const uint8_t *data, ssize_t n)
+    {
+        link.datagrams++;
+        if (fd < 0 || chance(loss))
+        {
+            link.dropped++;
+            return;
+        }
+
+        Clock::time_point now = Clock::now();
+        Clock::time_point departs = now;
+        if (bitsPerSecond > 0)
+        {
+            if (link.queued >= queueLimit)
+            {
+                link.overflowed++;
+                return;
+            }
+            departs = max(now, link.busyUntil) + chrono::duration_cast<Clock::duration>(chrono::duration<double>(n * 8 / bitsPerSecond));
+            link.busyUntil = departs;
+        }
+
+        int copies = chance(dup) ? 2 : 1;
+        link.duplicated += copies - 1;
+        for (int c = 0; c < copies; c++)
+        {
+            vector<uint8_t> bytes(data, data + n);
+            if (n > 0 && chance(corrupt))
+            {
+                link.corrupted++;
+                bytes[static_cast<size_t>(uniform(rng) * n)] ^= static_cast<uint8_t>(1 + rng() % 255);
+            }
+            Clock::time_point at = departs + delay;
+            if (chance(reorder))
+            {
+                link.reordered++;
+                at += chrono::duration_cast<Clock::duration>(jitter * uniform(rng));
+            }
+            if (at <= now && pending.empty())
+            {
+                sendto(fd, bytes.data(), bytes.size(), 0, (const struct sockaddr *)&to, sizeof(to));
+                continue;
+            }
+            if (bitsPerSecond > 0)
+                link.queued++;
+            pending.push({at, order++, fd, to, &link, std::move(bytes)});
+        }
+    }
+
+    void flushDue()
+    {
+        Clock::time_point now = Clock::now();
+        while (!pending.empty() && pending.top().at <= now)
+        {
+            const Datagram &d = pending.top();
+            sendto(d.fd, d.bytes.data(), d.bytes.size(), 0, (const struct sockaddr *)&d.to, sizeof(d.to));
+            if (bitsPerSecond > 0)
+                d.link->queued--;
+            pending.pop();
+        }
+    }
+
+    void report() const
+    {
+        for (auto [name, link] : {pair{"forward", &forward}, pair{"backward", &backward}})
+        {
+            spdlog::info("{}: {} datagrams, {} lost, {} queue drops, {} duplicated, {} reordered, {} corrupted", name,
+                         link->datagrams, link->dropped, link->overflowed, link->duplicated, link->reordered, link->corrupted);
+        }
+    }
+};
+
+int main(int argc, char **argv)
+{
+    ios_base::sync_with_stdio(false);
+    spdlog::set_level(spdlog::level::info);
+
+    wProxy proxy;
+    if (proxy.parseArguments(argc, argv) || proxy.bindSocket())
+        return 1;
+
+    struct sigaction sa{};
+    sa.sa_handler = [](int)
+    { stopRequested = 1; };
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    proxy.run();
+    return 0;
+}
@@ -0,0 +1,1339 @@
+#pragma once
+
+#include <iostream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <string>
+#include <cxxopts.hpp>
+#include <spdlog/spdlog.h>
+#include <netdb.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
+#include <optional>
+#include <map>
+#include <memory>
+#include <filesystem>
+#include <algorithm>
+#include "../common/Batch.hpp"
+#include "../common/Compress.hpp"
+#include "../common/CopyChecksum.hpp"
+#include "../common/Crc32.hpp"
+#include "../common/Crc32c.hpp"
+#include "../common/Dedup.hpp"
+#include "../common/Fec.hpp"
+#include "../common/Histogram.hpp"
+#include "../common/ReorderBuffer.hpp"
+#include "../common/ResumeBitmap.hpp"
+#include "../common/StartOptions.hpp"
+#include "../common/Stats.hpp"
+#include "../common/Trace.hpp"
+#include "../common/Transport.hpp"
+#include <fstream>
+
+using namespace std;
+
+enum : uint32_t
+{
+    START = 0,
+    END = 1,
+    DATA = 2,
+    ACK = 3,
+    PROBE = 4, // path MTU probe; echoed back with length 0
+    FEC = 5,   // parity for a group of DATA packets, see common/Fec.hpp
+    CDATA = 6,   // DATA whose payload is a raw deflate stream, see common/Compress.hpp
+    MANIFEST = 7 // chunk hashes for dedup, see common/Dedup.hpp
+};
+struct PacketHeader
+{
+    uint32_t type;
+    uint32_t seqNum;
+    uint32_t length;
+    uint32_t checksum;
+};
+
+class wReceiver
+{
+public:
+    int port;
+    int window_size; // of the current session; -w until one is negotiated
+    int windowArg = 0;  // -w, or 0 for auto
+    uint64_t maxWindowBytes = 32 << 20; // --max-window-mb: what one flow's window may buffer with -w auto
+    string output_dir;
+    string output_log;
+    uint32_t maxPayload = StartOptions::MAX_PAYLOAD;
+
+    int sockfd = -1;
+    Transport *transport = nullptr; // a UdpTransport on sockfd unless one is injected
+    unique_ptr<Transport> udp;
+    TimeSource *clock = &SystemClock::instance();
+    sockaddr_in receiverAddr{};
+
+    struct FecGroup
+    {
+        uint32_t k = 0;
+        uint32_t m = 0;
+        size_t symLen = 0;
+        vector<vector<uint8_t>> parity; // a row stays empty until it arrives
+    };
+
+    struct WirePayload
+    {
+        uint32_t type; // DATA or CDATA
+        vector<uint8_t> bytes;
+    };
+
+    // Receive state of one sender socket. A plain transfer has a single flow;
+    // a striped transfer has one per stripe, told apart by source address.
+    struct Flow
+    {
+        uint32_t startSeqNum = 0;
+        uint32_t nextExpectedSeqNum = 0;
+        uint64_t writeOffset = 0; // output position of nextExpectedSeqNum
+        uint64_t firstChunk = 0;  // bitmap index of seqNum 0 when chunks are tracked
+        bool ended = false;
+        trace::Track trace;       // filed under the flow's stripe index
+        ReorderBuffer resend; // payloads ahead of nextExpectedSeqNum, one slot per window position
+
+        // In-order payloads gathered into one write; libstdc++ would hand
+        // each payload to its own writev.
+        vector<uint8_t> stage;
+        uint64_t stageOffset = 0; // output position of stage[0]
+        size_t staged = 0;
+
+        // FEC mode only: recent payloads, kept while a parity group may still
+        // need them, and the parity received for groups not yet delivered.
+        map<uint32_t, WirePayload> fecData;
+        map<uint32_t, FecGroup> fecGroups;
+    };
+
+    bool connection = false;
+    int fileNum = 0;
+    ofstream outputStream;
+    string outputName;      // FILE-i.out of the current session
+    uint64_t outputPos = 0; // put position of outputStream
+    ofstream loggingStream;
+
+    uint32_t sessionId = 0;
+    uint32_t stripeCount = 1;
+    uint32_t payloadSize = StartOptions::DEFAULT_PAYLOAD; // negotiated for the current session
+    uint32_t sessionFlags = 0;
+    uint32_t checksum = StartOptions::CHECKSUM_CRC32; // negotiated for the current session
+    bool fecEnabled = false;
+    bool compressEnabled = false;
+    bool flowControl = false; // DATA ACKs carry the flow's receive window
+    bool sackEnabled = false; // DATA ACKs carry the flow's in-order point and what is buffered past it
+
+    vector<uint8_t> ackPkt; // reused for every reply
+    vector<uint8_t> ackExtras; // a DATA ACK's payload under flow control or SACK, reused
+
+    ChunkDecompressor decompressor;
+    vector<uint8_t> inflated; // one chunk, decompressed before the ordered write
+
+    // Resume and dedup sessions track which chunks are already in the output,
+    // so each flow's in-order point can step over them. Resume sessions write
+    // into <transfer ID>.part and keep the bitmap in <transfer ID>.bitmap
+    // until the transfer completes.
+    bool resumeEnabled = false;
+    bool dedupEnabled = false;
+    bool trackChunks = false;
+    ResumeBitmap received;
+    ifstream reference; // dedup: the file chunks are copied from
+
+    unique_ptr<batch::Writer> batchWriter; // batch sessions write files under output_dir instead
+
+    // 0-RTT: DATA from a source with no flow yet, kept until its START is
+    // accepted. Its CRCs are keyed with the session ID, so DATA left over
+    // from another connection can never pass for this one.
+    uint32_t dataKey = 0; // xored into DATA checksums of a 0-RTT session
+    unordered_map<uint64_t, vector<vector<uint8_t>>> earlyData;
+    static constexpr size_t MAX_EARLY_SOURCES = 16;
+    string partPath, bitmapPath;
+    TimeSource::Clock::time_point lastSave{};
+    static constexpr auto RESUME_SAVE_INTERVAL = chrono::milliseconds(500);
+    static constexpr size_t OUTPUT_STAGE = 64 * 1024; // bytes of in-order payload per write
+
+    static constexpr uint32_t SUPPORTED_FLAGS = StartOptions::FLAG_FEC | StartOptions::FLAG_COMPRESS |
+                                               StartOptions::FLAG_RESUME | StartOptions::FLAG_DEDUP |
+                                               StartOptions::FLAG_BATCH | StartOptions::FLAG_ZERO_RTT |
+                                               StartOptions::FLAG_FLOW_CONTROL | StartOptions::FLAG_WINDOW |
+                                               StartOptions::FLAG_SACK;
+    static constexpr uint32_t SUPPORTED_CHECKSUMS = StartOptions::CHECKSUM_CRC32 | StartOptions::CHECKSUM_CRC32C;
+    size_t flowsEnded = 0;
+
+    // Counters for the --stats report, reset when a session begins. The
+    // receiver is single-threaded; the SIGUSR1 report is written from the
+    // receive loop.
+    struct ReceiverStats
+    {
+        stats::Counter datagrams, bytes;         // everything after START
+        stats::Counter dataPackets;              // DATA that passed its checks
+        stats::Counter crcFailures, malformed;   // bad checksum; length or type wrong
+        stats::Counter duplicates;               // DATA already delivered or buffered
+        stats::Counter outOfWindow, bufferRejects;
+        stats::Counter reorderHighWater;         // most payloads one flow held at once
+        stats::Counter delivered, deliveredBytes;
+        stats::Counter acks;                     // every reply sent
+        stats::Counter fecRebuilt;
+        stats::Histogram processingNs;           // datagram received to its first reply sent
+    };
+    ReceiverStats counters;
+    string statsPath; // --stats; stderr if empty
+    TimeSource::Clock::duration statsInterval{}; // --stats-interval; zero for END and SIGUSR1 only
+    TimeSource::Clock::time_point sessionStarted{};
+    TimeSource::Clock::time_point nextStatsAt{};
+    TimeSource::Clock::time_point arrived{}; // of the datagram being handled, until it is answered
+
+    unique_ptr<trace::Writer> traceFile; // --trace
+    trace::Writer *tracer = nullptr;     // traceFile, or a writer the simulator shares
+    unordered_map<uint64_t, Flow> flows;
+    unordered_map<uint64_t, uint32_t> closedFlows; // previous session, to re-ACK a retransmitted END
+
+    static uint64_t flowKey(const sockaddr_in &addr)
+    {
+        return (static_cast<uint64_t>(addr.sin_addr.s_addr) << 16) | addr.sin_port;
+    }
+
+    void ntohl_func(PacketHeader &h)
+    {
+        h.type = ntohl(h.type);
+        h.seqNum = ntohl(h.seqNum);
+        h.length = ntohl(h.length);
+        h.checksum = ntohl(h.checksum);
+    }
+
+    void htonl_func(PacketHeader &h)
+    {
+        h.type = htonl(h.type);
+        h.seqNum = htonl(h.seqNum);
+        h.length = htonl(h.length);
+        h.checksum = htonl(h.checksum);
+    }
+
+    // Builds the packet in buff, which keeps its capacity from call to call.
+    void makePacket(vector<uint8_t> &buff, uint32_t type, uint32_t seq, const uint8_t *data, size_t packLen)
+    {
+
+        PacketHeader h{type, seq, static_cast<uint32_t>(packLen), (packLen > 0) ? crc32(data, packLen) : 0};
+        PacketHeader h2 = h;
+        htonl_func(h2);
+        buff.resize(sizeof(PacketHeader) + packLen);
+        memcpy(buff.data(), &h2, sizeof(h2));
+        if (packLen > 0)
+            memcpy(buff.data() + sizeof(h2), data, packLen);
+    }
+
+    // Returns false if the port cannot be bound.
+    bool bindSocket()
+    {
+        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        memset(&receiverAddr, 0, sizeof(receiverAddr));
+        receiverAddr.sin_family = AF_INET;
+        receiverAddr.sin_addr.s_addr = INADDR_ANY;
+        receiverAddr.sin_port = htons(port);
+
+        if (::bind(sockfd, (struct sockaddr *)&receiverAddr, sizeof(receiverAddr)) < 0)
+        {
+            perror("bind failed");
+            close(sockfd);
+            return false;
+        }
+        udp = make_unique<UdpTransport>(sockfd);
+        transport = udp.get();
+
+        spdlog::debug("Socket successfully created and bound to port {}", port);
+        return true;
+    }
+
+    int parseArguments(int argc, char **argv)
+    {
+        cxxopts::Options opts("wReceiver");
+        opts.add_options()("p,port", "The port number on which wReceiver is listening", cxxopts::value<int>())("w,window-size", "Maximum number of outstanding packets in the current window, or \"auto\" to accept what the sender asks for up to --max-window-mb.", cxxopts::value<string>())("max-window-mb", "Memory cap on one flow's window with -w auto.", cxxopts::value<uint64_t>()->default_value("32"))("d,output-dir", "Path to the file that has to be transferred. It can be a text file or binary file.", cxxopts::value<string>())("o,output-log", "The file path to which you should log the messages as described above.", cxxopts::value<string>())("max-payload", "Largest DATA payload to accept when a sender offers a bigger one.", cxxopts::value<uint32_t>()->default_value(to_string(StartOptions::MAX_PAYLOAD)))("stats", "Append a JSON summary of each session to this file at END and on SIGUSR1; stderr if not given.", cxxopts::value<string>()->default_value(""))("stats-interval", "Also write the summary every this many seconds during a session.", cxxopts::value<double>()->default_value("0"))("trace", "Record ACKs, reorder buffer occupancy and disk writes to this file as Chrome trace JSON.", cxxopts::value<string>()->default_value(""));
+        // -p | --port The port number on which wReceiver is listening for data.
+        // -w | --window-size Maximum number of outstanding packets.
+        // -d | --output-dir The directory that the wReceiver will store the output files, i.e the FILE-i.out files.
+        // -o | --output-log The file path to which you should log the messages as described above.
+        // ./wReceiver -p 8000 -w 10 -d /tmp -o receiver.out
+
+        cxxopts::ParseResult result;
+        try
+        {
+            result = opts.parse(argc, argv);
+        }
+        catch (const exception &e)
+        {
+            cerr << "Error parsing options: " << e.what() << "\n\n"
+                 << opts.help() << "\n";
+            return 1;
+        }
+
+        if (!result.count("port") || !result.count("output-dir") || !result.count("output-log") || !result.count("window-size"))
+        {
+            cerr << "Error: Missing required arguments\n\n"
+                 << opts.help() << "\n";
+            return 1;
+        }
+
+        port = result["port"].as<int>();
+        string window = result["window-size"].as<string>();
+        if (window != "auto")
+        {
+            try
+            {
+                windowArg = stoi(window);
+            }
+            catch (const exception &)
+            {
+                windowArg = 0;
+            }
+            if (windowArg < 1)
+            {
+                spdlog::error("Error: window size must be a positive number or auto\n");
+                return 1;
+            }
+        }
+        maxWindowBytes = result["max-window-mb"].as<uint64_t>() << 20;
+        window_size = windowLimit();
+        output_dir = result["output-dir"].as<string>();
+        output_log = result["output-log"].as<string>();
+        maxPayload = result["max-payload"].as<uint32_t>();
+        statsPath = result["stats"].as<string>();
+        statsInterval = chrono::duration_cast<TimeSource::Clock::duration>(chrono::duration<double>(max(0.0, result["stats-interval"].as<double>())));
+
+        if (port < 1024 || port > 65535)
+        {
+            spdlog::error("Error: port number must be in the range of [1024, 65535]\n");
+            return 1;
+        }
+
+        if (maxPayload < 1 || maxPayload > StartOptions::MAX_PAYLOAD)
+        {
+            spdlog::error("Error: max payload must be in the range of [1, {}]\n", StartOptions::MAX_PAYLOAD);
+            return 1;
+        }
+
+        loggingStream.open(output_log, std::ios::out | std::ios::trunc);
+        if (!loggingStream)
+        {
+            spdlog::error("Failed to open output log: ");
+            return 1;
+        }
+
+        string tracePath = result["trace"].as<string>();
+        if (!tracePath.empty())
+        {
+            traceFile = make_unique<trace::Writer>();
+            if (!traceFile->open(tracePath))
+            {
+                spdlog::error("Error: cannot write trace file {}\n", tracePath);
+                return 1;
+            }
+            tracer = traceFile.get();
+            tracer->nameProcess(trace::RECEIVER_PID, "wReceiver");
+        }
+
+        spdlog::debug("Arguments parsed successfully: port={}, window_size={}, output_dir={}, output_log={}", port, window_size, output_dir, output_log);
+        return 0;
+    }
+
+    void ackAndLog(uint32_t seqNum, sockaddr_in &clientAddr, const vector<uint8_t> &payload = {})
+    {
+        replyAndLog(ACK, seqNum, clientAddr, payload);
+    }
+
+    void replyAndLog(uint32_t type, uint32_t seqNum, sockaddr_in &clientAddr, const vector<uint8_t> &payload = {})
+    {
+        makePacket(ackPkt, type, seqNum, payload.data(), payload.size());
+        transport->sendTo(ackPkt.data(), ackPkt.size(), clientAddr);
+        counters.acks.add();
+        if (arrived != TimeSource::Clock::time_point{})
+        {
+            auto took = clock->now() - arrived;
+            counters.processingNs.record(static_cast<uint64_t>(max<int64_t>(0, chrono::duration_cast<chrono::nanoseconds>(took).count())));
+            arrived = {};
+        }
+
+        PacketHeader ack{};
+        memcpy(&ack, ackPkt.data(), sizeof(ack));
+        ntohl_func(ack);
+        loggingStream << ack.type << ' ' << ack.seqNum << ' ' << ack.length << ' ' << ack.checksum << '\n';
+        loggingStream.flush();
+    }
+
+    // Returns false if the START is damaged and should be dropped. opts is left
+    // empty for a plain WTP START.
+    bool readStartOptions(const PacketHeader &h, const uint8_t *data, ssize_t n, optional<StartOptions> &opts)
+    {
+        if (h.length == 0)
+            return true;
+        if (n != static_cast<ssize_t>(sizeof(PacketHeader) + h.length) || crc32(data, h.length) != h.checksum)
+        {
+            spdlog::debug("Dropping damaged START options");
+            return false;
+        }
+        StartOptions parsed;
+        if (parsed.decode(data, h.length))
+            opts = parsed;
+        return true;
+    }
+
+    // The checksum to use from the sender's set: the newest both sides know,
+    // newer algorithms having higher bits. Every WTP peer speaks CRC32, so a
+    // set with nothing in common falls back to it.
+    static uint32_t pickChecksum(uint32_t offered)
+    {
+        uint32_t common = offered & SUPPORTED_CHECKSUMS;
+        return common ? bit_floor(common) : StartOptions::CHECKSUM_CRC32;
+    }
+
+    // The session's checksum, which covers everything the sender sends after
+    // START. Our replies keep CRC32: the START ACK is what names the choice.
+    uint32_t checksumOf(const uint8_t *data, size_t length) const
+    {
+        return checksum == StartOptions::CHECKSUM_CRC32C ? crc32c(data, length) : crc32(data, length);
+    }
+
+    // checksumOf() of data, taken while copying it to dst.
+    uint32_t copyChecksumOf(uint8_t *dst, const uint8_t *data, size_t length) const
+    {
+        return checksum == StartOptions::CHECKSUM_CRC32C ? crc32cCopy(dst, data, length) : crc32Copy(dst, data, length);
+    }
+
+    // Most packets one flow may buffer: -w, or with -w auto as many datagrams
+    // as fit in --max-window-mb.
+    int windowLimit() const
+    {
+        if (windowArg)
+            return windowArg;
+        return static_cast<int>(clamp<uint64_t>(maxWindowBytes / (sizeof(PacketHeader) + payloadSize), 1, INT32_MAX));
+    }
+
+    // Settles the payload size and window for a new session and sizes the
+    // socket buffer so a full window of the largest datagrams fits. A sender
+    // that names its window gets the smaller of it and ours, and both sides
+    // use that.
+    void setSessionSizes(optional<StartOptions> &opts)
+    {
+        payloadSize = opts ? min(opts->payloadSize, maxPayload) : StartOptions::DEFAULT_PAYLOAD;
+        window_size = windowLimit();
+        if (opts && (opts->flags & StartOptions::FLAG_WINDOW))
+            window_size = static_cast<int>(min<uint64_t>(opts->window, window_size));
+        // The kernel charges per-datagram overhead against the buffer, hence the headroom.
+        uint64_t wanted = 2 * uint64_t(window_size) * stripeCount * (sizeof(PacketHeader) + payloadSize);
+        int current = 0;
+        socklen_t optlen = sizeof(current);
+        getsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &current, &optlen);
+        if (wanted > static_cast<uint64_t>(current))
+        {
+            int rcvbuf = static_cast<int>(min<uint64_t>(INT32_MAX, wanted));
+            setsockopt(sockfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        }
+        spdlog::debug("Session payload size is {}, window {}", payloadSize, window_size);
+    }
+
+    // The START ACK payload: the offer with the accepted values filled in.
+    vector<uint8_t> echoOptions(optional<StartOptions> &opts, const Flow &flow)
+    {
+        if (!opts)
+            return {};
+        opts->version = min(opts->version, StartOptions::VERSION);
+        opts->payloadSize = payloadSize;
+        opts->checksums = checksum;
+        opts->flags = sessionFlags;
+        opts->window = window_size;
+        opts->reference.clear();
+        if (trackChunks)
+        {
+            opts->chunkSize = received.chunkSize;
+            opts->haveRuns = received.runs(flow.firstChunk, StartOptions::MAX_RUNS);
+        }
+        return opts->encode();
+    }
+
+    void addFlow(const PacketHeader &h, sockaddr_in &clientAddr, optional<StartOptions> &opts)
+    {
+        Flow &flow = flows[flowKey(clientAddr)];
+        flow.startSeqNum = h.seqNum;
+        flow.writeOffset = opts ? opts->stripeOffset : 0;
+        flow.resend.reset(window_size, payloadSize);
+        if (!batchWriter)
+            flow.stage.resize(max<size_t>(OUTPUT_STAGE, payloadSize));
+        if (tracer)
+        {
+            uint32_t stripe = opts ? opts->stripeIndex : 0;
+            flow.trace = {tracer, trace::RECEIVER_PID, stripe};
+            tracer->nameThread(trace::RECEIVER_PID, stripe, "flow " + to_string(stripe));
+        }
+        if (trackChunks)
+        {
+            flow.firstChunk = opts->stripeOffset / received.chunkSize;
+            skipReceived(flow);
+        }
+        spdlog::debug("Flow {} of {} established with startSeqNum={}", opts ? opts->stripeIndex : 0, stripeCount, h.seqNum);
+        ackAndLog(h.seqNum, clientAddr, echoOptions(opts, flow));
+        replayEarlyData(flow, clientAddr);
+    }
+
+    void stashEarlyData(const sockaddr_in &clientAddr, const uint8_t *packet, ssize_t n)
+    {
+        uint64_t key = flowKey(clientAddr);
+        auto it = earlyData.find(key);
+        if (it == earlyData.end())
+        {
+            if (earlyData.size() >= MAX_EARLY_SOURCES)
+                earlyData.erase(earlyData.begin());
+            it = earlyData.emplace(key, vector<vector<uint8_t>>{}).first;
+        }
+        if (it->second.size() < static_cast<size_t>(window_size))
+            it->second.emplace_back(packet, packet + n);
+    }
+
+    // Runs DATA that arrived ahead of this flow's START through the normal
+    // path. Outside a 0-RTT session it is dropped; the sender resends it.
+    void replayEarlyData(Flow &flow, sockaddr_in &clientAddr)
+    {
+        auto it = earlyData.find(flowKey(clientAddr));
+        if (it == earlyData.end())
+            return;
+        vector<vector<uint8_t>> packets = move(it->second);
+        earlyData.erase(it);
+        if (!(sessionFlags & StartOptions::FLAG_ZERO_RTT))
+            return;
+        spdlog::debug("Replaying {} DATA packets that arrived before START", packets.size());
+        for (const auto &pkt : packets)
+        {
+            PacketHeader h{};
+            memcpy(&h, pkt.data(), sizeof(h));
+            ntohl_func(h);
+            handleDataPacket(flow, h, pkt.data() + sizeof(PacketHeader), static_cast<ssize_t>(pkt.size()), clientAddr);
+        }
+    }
+
+    // Opens the partial output of a resume session, continuing from its
+    // bitmap when one matches this transfer.
+    void openResumeOutput(const StartOptions &opts, uint32_t chunk)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "resume-%016llx", static_cast<unsigned long long>(opts.transferId));
+        partPath = output_dir + "/" + name + ".part";
+        bitmapPath = output_dir + "/" + name + ".bitmap";
+        bool resumed = filesystem::exists(partPath) && received.load(bitmapPath, opts.transferId, opts.fileSize, chunk);
+        if (!resumed)
+        {
+            received.reset(opts.transferId, opts.fileSize, chunk);
+            ofstream(partPath, ios::binary | ios::trunc);
+        }
+        outputStream.open(partPath, ios::binary | ios::in | ios::out);
+        lastSave = clock->now();
+        spdlog::info("{} transfer {} into {}", resumed ? "Resuming" : "Starting resumable", name, partPath);
+    }
+
+    // Flushes the output and then the bitmap, at most every RESUME_SAVE_INTERVAL
+    // unless forced, so the record never claims a chunk that is not on disk.
+    void saveResumeState(bool force)
+    {
+        if (!resumeEnabled)
+            return;
+        auto now = clock->now();
+        if (!force && now - lastSave < RESUME_SAVE_INTERVAL)
+            return;
+        flushOutput();
+        outputStream.flush();
+        if (!received.save(bitmapPath))
+            spdlog::error("Failed to save resume state to {}", bitmapPath);
+        lastSave = now;
+    }
+
+    // Moves the flow's in-order point past chunks an earlier session wrote.
+    void skipReceived(Flow &flow)
+    {
+        while (received.test(flow.firstChunk + flow.nextExpectedSeqNum))
+        {
+            ++flow.nextExpectedSeqNum;
+            flow.writeOffset += received.chunkSize;
+        }
+    }
+
+    void beginSession(const PacketHeader &h, sockaddr_in &clientAddr, optional<StartOptions> &opts)
+    {
+        spdlog::debug("START packet received, establishing connection...");
+        connection = true;
+        resetStats();
+        flows.clear();
+        closedFlows.clear();
+        flowsEnded = 0;
+        sessionId = opts ? opts->sessionId : 0;
+        stripeCount = opts ? opts->stripeCount : 1;
+        setSessionSizes(opts);
+        sessionFlags = opts ? (opts->flags & SUPPORTED_FLAGS) : 0;
+        if (payloadSize <= fec::OVERHEAD)
+            sessionFlags &= ~StartOptions::FLAG_FEC;
+        // Early DATA is cut for the default payload; refusing makes the sender re-chunk.
+        if (payloadSize < StartOptions::DEFAULT_PAYLOAD)
+            sessionFlags &= ~StartOptions::FLAG_ZERO_RTT;
+        dataKey = (sessionFlags & StartOptions::FLAG_ZERO_RTT) ? sessionId : 0;
+        fecEnabled = sessionFlags & StartOptions::FLAG_FEC;
+        compressEnabled = sessionFlags & StartOptions::FLAG_COMPRESS;
+        flowControl = sessionFlags & StartOptions::FLAG_FLOW_CONTROL;
+        sackEnabled = sessionFlags & StartOptions::FLAG_SACK;
+        checksum = pickChecksum(opts ? opts->checksums : StartOptions::CHECKSUM_CRC32);
+        resumeEnabled = sessionFlags & StartOptions::FLAG_RESUME;
+        inflated.resize(payloadSize);
+        outputName = output_dir + "/FILE-" + to_string(fileNum) + ".out";
+        dedupEnabled = (sessionFlags & StartOptions::FLAG_DEDUP) && openReference(opts->reference);
+        if (!dedupEnabled)
+            sessionFlags &= ~StartOptions::FLAG_DEDUP;
+        trackChunks = resumeEnabled || dedupEnabled;
+        // A batch is one ordered stream, so it needs a single flow and no chunk skipping.
+        if (stripeCount > 1 || trackChunks)
+            sessionFlags &= ~StartOptions::FLAG_BATCH;
+        batchWriter.reset();
+        uint32_t chunk = payloadSize - (fecEnabled ? fec::OVERHEAD : 0);
+        if (sessionFlags & StartOptions::FLAG_BATCH)
+            batchWriter = make_unique<batch::Writer>(output_dir);
+        else if (resumeEnabled)
+            openResumeOutput(*opts, chunk);
+        else
+            outputStream.open(outputName, ios::binary | ios::trunc);
+        if (trackChunks && !resumeEnabled)
+            received.reset(0, opts->fileSize, chunk);
+        outputPos = 0;
+        fileNum++;
+        addFlow(h, clientAddr, opts);
+    }
+
+    // Dedup: opens the reference, which must be a plain name in output_dir
+    // other than the file this session is about to write.
+    bool openReference(const string &name)
+    {
+        reference.close();
+        if (name.empty() || name == "." || name == ".." || name.find('/') != string::npos ||
+            output_dir + "/" + name == outputName || payloadSize < dedup::HASH_SIZE)
+        {
+            spdlog::debug("Refusing dedup reference \"{}\"", name);
+            return false;
+        }
+        reference.open(output_dir + "/" + name, ios::binary);
+        if (!reference)
+        {
+            spdlog::info("Dedup reference {} not found, receiving every chunk", name);
+            return false;
+        }
+        return true;
+    }
+
+    // Dedup: checks each hash of a MANIFEST packet against the same chunk of
+    // the reference, copies the ones that match into the output and answers
+    // with a bitmap of the chunks now present. Matching is by position, which
+    // covers images and artifacts that are modified in place.
+    void handleManifest(Flow &flow, const PacketHeader &h, const uint8_t *data, sockaddr_in &clientAddr)
+    {
+        size_t count = h.length / dedup::HASH_SIZE;
+        vector<uint8_t> have((count + 7) / 8, 0);
+        vector<uint8_t> chunk(received.chunkSize);
+        size_t copied = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            uint64_t c = flow.firstChunk + h.seqNum + i;
+            if (c >= received.numChunks())
+                break;
+            if (!received.test(c))
+            {
+                uint64_t offset = c * received.chunkSize;
+                size_t chunkLen = static_cast<size_t>(min<uint64_t>(received.chunkSize, received.fileSize - offset));
+                reference.clear();
+                reference.seekg(static_cast<streamoff>(offset));
+                reference.read(reinterpret_cast<char *>(chunk.data()), static_cast<streamsize>(chunkLen));
+                if (static_cast<size_t>(reference.gcount()) != chunkLen ||
+                    !dedup::matches(chunk.data(), chunkLen, data + i * dedup::HASH_SIZE))
+                    continue;
+                outputStream.seekp(static_cast<streamoff>(offset));
+                outputStream.write(reinterpret_cast<const char *>(chunk.data()), static_cast<streamsize>(chunkLen));
+                outputPos = offset + chunkLen;
+                received.set(c);
+                copied++;
+            }
+            have[i / 8] |= static_cast<uint8_t>(1 << (i % 8));
+        }
+        spdlog::debug("Manifest at seqNum={}: {} of {} chunks copied from the reference", h.seqNum, copied, count);
+        skipReceived(flow);
+        saveResumeState(false);
+        replyAndLog(MANIFEST, h.seqNum, clientAddr, have);
+    }
+
+    void resetStats()
+    {
+        for (stats::Counter *c : {&counters.datagrams, &counters.bytes, &counters.dataPackets, &counters.crcFailures,
+                                  &counters.malformed, &counters.duplicates, &counters.outOfWindow, &counters.bufferRejects,
+                                  &counters.reorderHighWater, &counters.delivered, &counters.deliveredBytes, &counters.acks,
+                                  &counters.fecRebuilt})
+            c->reset();
+        counters.processingNs.reset();
+        sessionStarted = clock->now();
+        nextStatsAt = statsInterval > TimeSource::Clock::duration::zero() ? sessionStarted + statsInterval : TimeSource::Clock::time_point{};
+    }
+
+    // Writes the report if SIGUSR1 arrived or the next interval is due.
+    void pollStats()
+    {
+        if (stats::dumpPending())
+            writeStats("signal");
+        if (nextStatsAt != TimeSource::Clock::time_point{} && clock->now() >= nextStatsAt)
+        {
+            writeStats("interval");
+            nextStatsAt = clock->now() + statsInterval;
+        }
+    }
+
+    string statsJson(const char *event)
+    {
+        double elapsed = sessionStarted == TimeSource::Clock::time_point{} ? 0.0 : chrono::duration<double>(clock->now() - sessionStarted).count();
+        return stats::JsonObject()
+            .field("role", string("receiver"))
+            .field("event", string(event))
+            .field("session", static_cast<uint64_t>(sessionId))
+            .field("elapsed_s", elapsed)
+            .field("packets_received", counters.datagrams.get())
+            .field("bytes_received", counters.bytes.get())
+            .field("data_packets", counters.dataPackets.get())
+            .field("crc_failures", counters.crcFailures.get())
+            .field("malformed", counters.malformed.get())
+            .field("duplicates", counters.duplicates.get())
+            .field("out_of_window", counters.outOfWindow.get())
+            .field("buffer_rejects", counters.bufferRejects.get())
+            .field("reorder_high_water", counters.reorderHighWater.get())
+            .field("delivered", counters.delivered.get())
+            .field("delivered_bytes", counters.deliveredBytes.get())
+            .field("acks_sent", counters.acks.get())
+            .field("fec_rebuilt", counters.fecRebuilt.get())
+            .raw("processing_ns", counters.processingNs.json())
+            .str();
+    }
+
+    void writeStats(const char *event)
+    {
+        stats::write(statsPath, statsJson(event));
+    }
+
+    void endSession()
+    {
+        if (batchWriter)
+        {
+            if (!batchWriter->complete())
+                spdlog::error("Batch ended before all of its {} files arrived", batchWriter->fileCount());
+            batchWriter.reset();
+        }
+        if (outputStream.is_open())
+        {
+            flushOutput();
+            outputStream.flush();
+            outputStream.close();
+        }
+        if (resumeEnabled)
+        {
+            error_code ec;
+            filesystem::resize_file(partPath, received.fileSize, ec);
+            filesystem::rename(partPath, outputName, ec);
+            if (ec)
+                spdlog::error("Failed to move {} to {}: {}", partPath, outputName, ec.message());
+            filesystem::remove(bitmapPath, ec);
+        }
+        connection = false;
+        closedFlows.clear();
+        for (const auto &[key, flow] : flows)
+            closedFlows[key] = flow.startSeqNum;
+        flows.clear();
+        if (tracer)
+            tracer->flush();
+    }
+
+    void startProtocol()
+    {
+        vector<uint8_t> receivedPktHeader(sizeof(PacketHeader) + 1456);
+        while (true)
+        {
+            spdlog::debug("Waiting for START packet...");
+            sockaddr_in clientAddr{};
+            ssize_t n = transport->recvFrom(receivedPktHeader.data(), receivedPktHeader.size(), clientAddr, true);
+            if (stats::dumpPending())
+                writeStats("signal");
+            if (handleIdleDatagram(receivedPktHeader.data(), n, clientAddr))
+                break;
+        }
+    }
+
+    // Between sessions: returns true once a START has begun a new one.
+    bool handleIdleDatagram(const uint8_t *buf, ssize_t n, sockaddr_in &clientAddr)
+    {
+        spdlog::debug("Received {} bytes for header", n);
+        if (n < static_cast<ssize_t>(sizeof(PacketHeader)))
+        {
+            return false;
+        }
+        PacketHeader h{};
+        memcpy(&h, buf, sizeof(h));
+        ntohl_func(h);
+        loggingStream << h.type << ' ' << h.seqNum << ' ' << h.length << ' ' << h.checksum << '\n';
+        loggingStream.flush();
+        spdlog::debug("Packet type: {}, seqNum: {}", h.type, h.seqNum);
+        if (h.type == END)
+        {
+            // Our END ACK for the previous transfer was lost.
+            auto it = closedFlows.find(flowKey(clientAddr));
+            if (it != closedFlows.end() && it->second == h.seqNum)
+                ackAndLog(h.seqNum, clientAddr);
+            return false;
+        }
+        if (h.type == DATA)
+        {
+            stashEarlyData(clientAddr, buf, n);
+            return false;
+        }
+        if (h.type != START)
+        {
+            return false;
+        }
+        optional<StartOptions> opts;
+        if (!readStartOptions(h, buf + sizeof(PacketHeader), n, opts))
+            return false;
+        if (opts && opts->stripeIndex != 0)
+        {
+            spdlog::debug("Stripe {} START without an active session", opts->stripeIndex);
+            return false;
+        }
+        beginSession(h, clientAddr, opts);
+        return true;
+    }
+
+    // Returns true if the START replaced the current session with a new one.
+    bool handleStart(const PacketHeader &h, const uint8_t *data, ssize_t n, sockaddr_in &clientAddr)
+    {
+        optional<StartOptions> opts;
+        if (!readStartOptions(h, data, n, opts))
+            return false;
+        loggingStream << h.type << ' ' << h.seqNum << ' ' << h.length << ' ' << h.checksum << '\n';
+        loggingStream.flush();
+
+        if (opts && (opts->flags & StartOptions::FLAG_RESUME) && opts->stripeIndex == 0 && opts->sessionId != sessionId &&
+            resumeEnabled && opts->transferId == received.transferId)
+        {
+            // The sender of this transfer restarted to resume it; its old
+            // session is gone. The transfer keeps its output file.
+            spdlog::info("Abandoning session {} for the resumed transfer", sessionId);
+            saveResumeState(true);
+            flushOutput();
+            outputStream.close();
+            fileNum--;
+            beginSession(h, clientAddr, opts);
+            return true;
+        }
+        auto it = flows.find(flowKey(clientAddr));
+        if (it != flows.end())
+        {
+            // Our START ACK was lost; answer the retransmission again.
+            if (it->second.startSeqNum == h.seqNum)
+                ackAndLog(h.seqNum, clientAddr, echoOptions(opts, it->second));
+            return false;
+        }
+        if (!opts || opts->sessionId != sessionId || flows.size() >= stripeCount)
+        {
+            spdlog::debug("Ignoring START for another session while busy");
+            return false;
+        }
+        addFlow(h, clientAddr, opts);
+        return false;
+    }
+
+    // Writes the payload of nextExpectedSeqNum, by way of the output stage,
+    // and moves past it. A resume session also records the chunk and skips
+    // ones already on disk.
+    void writeInOrder(Flow &flow, const uint8_t *data, size_t length)
+    {
+        if (batchWriter)
+            batchWriter->write(data, length);
+        else
+        {
+            uint8_t *to = stageFor(flow, length);
+            if (to != data)
+                memcpy(to, data, length);
+            flow.staged += length;
+        }
+        flow.writeOffset += length;
+        ++flow.nextExpectedSeqNum;
+        counters.delivered.add();
+        counters.deliveredBytes.add(length);
+        if (trackChunks)
+        {
+            received.set(flow.firstChunk + flow.nextExpectedSeqNum - 1);
+            skipReceived(flow);
+            saveResumeState(false);
+        }
+    }
+
+    // Where the flow's next in-order payload goes in its output stage. What
+    // the stage holds is written out first if the payload would not follow
+    // it, as after a resume skip, or would not fit.
+    uint8_t *stageFor(Flow &flow, size_t length)
+    {
+        if (flow.staged > 0 && (flow.stageOffset + flow.staged != flow.writeOffset || flow.staged + length > flow.stage.size()))
+            flushStage(flow);
+        if (flow.staged == 0)
+        {
+            flow.stageOffset = flow.writeOffset;
+            if (length > flow.stage.size())
+                flow.stage.resize(length); // a sender ignoring the negotiated payload size
+        }
+        return flow.stage.data() + flow.staged;
+    }
+
+    void flushStage(Flow &flow)
+    {
+        if (flow.staged == 0)
+            return;
+        auto writeStart = flow.trace ? clock->now() : TimeSource::Clock::time_point{};
+        if (outputPos != flow.stageOffset)
+            outputStream.seekp(static_cast<streamoff>(flow.stageOffset));
+        outputStream.write(reinterpret_cast<const char *>(flow.stage.data()), static_cast<streamsize>(flow.staged));
+        outputPos = flow.stageOffset + flow.staged;
+        if (flow.trace)
+            flow.trace.complete("write", writeStart, clock->now() - writeStart, {{"offset", flow.stageOffset}, {"bytes", flow.staged}});
+        flow.staged = 0;
+    }
+
+    void flushOutput()
+    {
+        for (auto &[key, flow] : flows)
+            flushStage(flow);
+    }
+
+    // Where a DATA payload for seq would be copied once accepted: the output
+    // stage when it is next in order, its reorder slot when it is ahead and
+    // the slot is free. nullptr when it will not be copied.
+    uint8_t *landingFor(Flow &flow, uint32_t seq, size_t length)
+    {
+        uint32_t N = flow.nextExpectedSeqNum;
+        if (seq == N)
+            return batchWriter ? nullptr : stageFor(flow, length);
+        if (seq > N && seq < N + window_size)
+            return flow.resend.slot(seq, length);
+        return nullptr;
+    }
+
+    void ackData(Flow &flow, uint32_t seq, sockaddr_in &clientAddr, const vector<uint8_t> &ackPayload)
+    {
+        if (flowControl || sackEnabled)
+        {
+            ackExtras.clear();
+            if (flowControl)
+                appendWord(ackExtras, receiveWindow(flow));
+            if (sackEnabled)
+            {
+                appendWord(ackExtras, flow.nextExpectedSeqNum);
+                appendWord(ackExtras, sackBits(flow));
+            }
+            ackExtras.insert(ackExtras.end(), ackPayload.begin(), ackPayload.end());
+            ackAndLog(seq, clientAddr, ackExtras);
+        }
+        else
+            ackAndLog(seq, clientAddr, ackPayload);
+        if (flow.trace)
+            flow.trace.instant("ack", clock->now(), {{"seq", seq}, {"next", flow.nextExpectedSeqNum}});
+    }
+
+    static void appendWord(vector<uint8_t> &out, uint32_t w)
+    {
+        w = htonl(w);
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(&w);
+        out.insert(out.end(), p, p + sizeof(w));
+    }
+
+    // Which of the SACK_SPAN seqNums past the flow's in-order point are buffered.
+    uint32_t sackBits(const Flow &flow) const
+    {
+        uint32_t bits = 0;
+        if (flow.resend.count() == 0)
+            return bits;
+        for (uint32_t i = 0; i < StartOptions::SACK_SPAN; i++)
+        {
+            if (flow.resend.contains(flow.nextExpectedSeqNum + 1 + i))
+                bits |= 1u << i;
+        }
+        return bits;
+    }
+
+    // How many packets the flow's sender may have in flight: the reorder
+    // buffer's free slots, less this flow's share of the datagrams queued in
+    // the socket. Disk writes run on the receive loop, so a slow disk shows
+    // up as that queue growing. Never 0, so the packet the flow is waiting
+    // for can always be sent.
+    uint32_t receiveWindow(const Flow &flow)
+    {
+        // setSessionSizes() allows each queued datagram twice its size for the kernel's overhead.
+        size_t queued = transport->pendingBytes() / (2 * (sizeof(PacketHeader) + payloadSize) * stripeCount);
+        size_t slots = flow.resend.freeSlots();
+        return static_cast<uint32_t>(max<size_t>(1, slots > queued ? slots - queued : 0));
+    }
+
+    // Delivers or buffers one verified DATA payload and ACKs it.
+    void acceptData(Flow &flow, uint32_t seq, const uint8_t *data, size_t length, sockaddr_in &clientAddr,
+                    const vector<uint8_t> &ackPayload = {})
+    {
+        uint32_t N = flow.nextExpectedSeqNum;
+        spdlog::debug("Next expected seqNum={}", N);
+
+        // If it receives a packet with seqNum=N, it will check for the highest sequence number (say M) of the in­order packets it has already received and send ACK with seqNum=M+1.
+        if (seq == N) // what ur expecting, need to deliver the buffer here
+        {
+            writeInOrder(flow, data, length);
+
+            size_t bufferedLen = 0;
+            while (const uint8_t *buffered = flow.resend.take(flow.nextExpectedSeqNum, bufferedLen))
+                writeInOrder(flow, buffered, bufferedLen);
+            // Resuming can skip the in-order point past buffered chunks.
+            flow.resend.dropBelow(flow.nextExpectedSeqNum);
+            if (flow.trace)
+                traceWindow(flow);
+            spdlog::debug("Sending ACK for seqNum={}", seq);
+            ackData(flow, seq, clientAddr, ackPayload);
+            // deliver the actual buffer not sure how we wanna implement that
+        }
+        else if (seq < N)
+        { // An older duplicate: our ACK for it was lost, so ACK it again or the sender retransmits forever
+            counters.duplicates.add();
+            ackData(flow, seq, clientAddr, ackPayload);
+        }
+        else if (seq >= N + window_size)
+        { // way ahead of what you want, just drop it
+            counters.outOfWindow.add();
+        }
+        else if (seq > N && seq < N + window_size) // get something ahead of what you want but still in range
+        {
+            /// need to buffer this packet for later use, add the buffer here
+            if (flow.resend.contains(seq))
+                counters.duplicates.add();
+            else if (!flow.resend.put(seq, data, length))
+            {
+                counters.bufferRejects.add();
+                spdlog::debug("No room to buffer seqNum={}, leaving it unacknowledged", seq);
+                return;
+            }
+            counters.reorderHighWater.raiseTo(flow.resend.count());
+            if (flow.trace)
+                traceWindow(flow);
+            spdlog::debug("Sending DUP ACK for seqNum={}", N);
+            ackData(flow, seq, clientAddr, ackPayload);
+        }
+    }
+
+    // The flow's in-order point and how many payloads wait behind it.
+    void traceWindow(const Flow &flow)
+    {
+        auto now = clock->now();
+        flow.trace.counter("nextExpectedSeqNum", now, flow.nextExpectedSeqNum);
+        flow.trace.counter("reorder_buffer", now, flow.resend.count());
+    }
+
+    // Inflates a CDATA payload before handing it to acceptData.
+    void deliverPayload(Flow &flow, uint32_t seq, uint32_t type, const uint8_t *data, size_t length,
+                        sockaddr_in &clientAddr, const vector<uint8_t> &ackPayload = {})
+    {
+        if (type == CDATA)
+        {
+            long inflatedLen = decompressor.decompress(data, length, inflated.data(), inflated.size());
+            if (inflatedLen < 0)
+            {
+                spdlog::debug("Dropping CDATA seqNum={} that does not inflate", seq);
+                return;
+            }
+            data = inflated.data();
+            length = static_cast<size_t>(inflatedLen);
+        }
+        acceptData(flow, seq, data, length, clientAddr, ackPayload);
+    }
+
+    void storeParity(Flow &flow, uint32_t start, const uint8_t *data, size_t length)
+    {
+        fec::FecHeader fh{};
+        if (length < fec::OVERHEAD)
+            return;
+        memcpy(&fh, data, sizeof(fh));
+        if (fh.k == 0 || fh.k > fec::MAX_K || fh.m == 0 || fh.m > fec::MAX_M || fh.index >= fh.m)
+            return;
+        if (start + fh.k <= flow.nextExpectedSeqNum)
+            return; // every packet of the group is already delivered
+
+        size_t symLen = length - sizeof(fh);
+        FecGroup &group = flow.fecGroups[start];
+        if (group.k == 0)
+        {
+            group.k = fh.k;
+            group.m = fh.m;
+            group.symLen = symLen;
+            group.parity.resize(fh.m);
+        }
+        if (group.k != fh.k || group.m != fh.m || group.symLen != symLen)
+            return;
+        group.parity[fh.index].assign(data + sizeof(fh), data + length);
+    }
+
+    // Rebuilds the missing packets of the group starting at start if enough
+    // parity has arrived, and hands them to acceptData as if received.
+    void decodeGroup(Flow &flow, uint32_t start, sockaddr_in &clientAddr)
+    {
+        FecGroup group = move(flow.fecGroups[start]);
+        flow.fecGroups.erase(start);
+
+        vector<vector<uint8_t>> symbols(group.k, vector<uint8_t>(group.symLen));
+        vector<uint8_t *> dataPtrs(group.k);
+        vector<const uint8_t *> parityPtrs(group.m, nullptr);
+        bool present[fec::MAX_K];
+        uint32_t missing = 0, received = 0;
+        for (uint32_t i = 0; i < group.k; i++)
+        {
+            auto it = flow.fecData.find(start + i);
+            present[i] = it != flow.fecData.end() && it->second.bytes.size() + 3 <= group.symLen;
+            if (present[i])
+                fec::makeSymbol(symbols[i].data(), group.symLen, it->second.type, it->second.bytes.data(), it->second.bytes.size());
+            else
+                missing++;
+            dataPtrs[i] = symbols[i].data();
+        }
+        for (uint32_t j = 0; j < group.m; j++)
+        {
+            if (!group.parity[j].empty())
+            {
+                parityPtrs[j] = group.parity[j].data();
+                received++;
+            }
+        }
+        if (missing == 0)
+            return;
+        if (missing > received || !fec::decode(group.k, group.m, dataPtrs.data(), present, parityPtrs.data(), group.symLen))
+        {
+            flow.fecGroups[start] = move(group); // wait for more parity or retransmissions
+            return;
+        }
+
+        static const vector<uint8_t> repairedAck(fec::REPAIRED_ACK_LENGTH, 1);
+        for (uint32_t i = 0; i < group.k; i++)
+        {
+            uint32_t type = DATA;
+            long length = present[i] ? -1 : fec::symbolPayload(symbols[i].data(), group.symLen, type);
+            if (length < 0 || (type != DATA && type != CDATA))
+                continue;
+            const uint8_t *payload = symbols[i].data() + 3;
+            spdlog::debug("Rebuilt seqNum={} from parity", start + i);
+            counters.fecRebuilt.add();
+            if (start + i >= flow.nextExpectedSeqNum)
+                flow.fecData[start + i] = {type, vector<uint8_t>(payload, payload + length)};
+            deliverPayload(flow, start + i, type, payload, length, clientAddr, repairedAck);
+        }
+    }
+
+    // Tries every parity group that could contain seq, then forgets groups and
+    // payloads the in-order point has moved past.
+    void fecRecover(Flow &flow, uint32_t seq, sockaddr_in &clientAddr)
+    {
+        uint32_t first = seq >= fec::MAX_K ? seq - fec::MAX_K + 1 : 0;
+        vector<uint32_t> starts;
+        for (auto it = flow.fecGroups.lower_bound(first); it != flow.fecGroups.end() && it->first <= seq; ++it)
+        {
+            if (seq < it->first + it->second.k)
+                starts.push_back(it->first);
+        }
+        for (uint32_t start : starts)
+            decodeGroup(flow, start, clientAddr);
+
+        uint32_t N = flow.nextExpectedSeqNum;
+        flow.fecData.erase(flow.fecData.begin(), flow.fecData.lower_bound(N >= fec::MAX_K ? N - fec::MAX_K : 0));
+        for (auto it = flow.fecGroups.begin(); it != flow.fecGroups.end() && it->first < N;)
+        {
+            if (it->first + it->second.k <= N)
+                it = flow.fecGroups.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    void handleData()
+    {
+        if (!connection)
+            return;
+
+        spdlog::debug("Handling data packets...");
+        vector<uint8_t> receviedPackets;
+        while (true)
+        {
+            // A resumed transfer can take over with a different payload size.
+            receviedPackets.resize(sizeof(PacketHeader) + payloadSize);
+            spdlog::debug("Waiting for data packet...");
+            sockaddr_in clientAddr{};
+            ssize_t n = transport->recvFrom(receviedPackets.data(), receviedPackets.size(), clientAddr, true);
+            arrived = clock->now();
+            bool ended = handleDatagram(receviedPackets.data(), n, clientAddr);
+            arrived = {};
+            if (ended)
+                break;
+            pollStats();
+        }
+    }
+
+    // In a session: returns true once the last flow's END closes it.
+    bool handleDatagram(uint8_t *buf, ssize_t n, sockaddr_in &clientAddr)
+    {
+        spdlog::debug("Received {} bytes", n);
+        if (n < 0)
+            return false;
+        counters.datagrams.add();
+        counters.bytes.add(static_cast<uint64_t>(n));
+        if (n < static_cast<ssize_t>(sizeof(PacketHeader)))
+        {
+            counters.malformed.add();
+            return false;
+        }
+        PacketHeader h{};
+        memcpy(&h, buf, sizeof(h));
+        ntohl_func(h);
+        spdlog::debug("Packet type: {}, seqNum: {}, length: {}, checksum: {}", h.type, h.seqNum, h.length, h.checksum);
+        uint8_t *data = buf + sizeof(PacketHeader);
+        if (h.type == START)
+        {
+            handleStart(h, data, n, clientAddr);
+            return false;
+        }
+
+        auto flowIt = flows.find(flowKey(clientAddr));
+        if (h.type == END)
+        {
+            loggingStream << h.type << ' ' << h.seqNum << ' ' << h.length << ' ' << h.checksum << '\n';
+            loggingStream.flush();
+            if (flowIt != flows.end() && h.seqNum == flowIt->second.startSeqNum)
+            {
+                ackAndLog(h.seqNum, clientAddr);
+                if (!flowIt->second.ended)
+                {
+                    flowIt->second.ended = true;
+                    flowsEnded++;
+                }
+                if (flowsEnded < stripeCount)
+                {
+                    spdlog::debug("Flow ended, {} of {} done", flowsEnded, stripeCount);
+                    return false;
+                }
+                endSession();
+                writeStats("end");
+                spdlog::debug("END packet received, connection closed");
+                return true;
+            }
+            spdlog::debug("END packet with wrong seq {}", h.seqNum);
+            return false;
+        }
+
+        if (flowIt == flows.end())
+        {
+            if (h.type == DATA)
+                stashEarlyData(clientAddr, buf, n);
+            else
+                spdlog::debug("Packet from unknown flow");
+            return false;
+        }
+        Flow &flow = flowIt->second;
+
+        if (h.type == PROBE)
+        {
+            loggingStream << h.type << ' ' << h.seqNum << ' ' << h.length << ' ' << h.checksum << '\n';
+            loggingStream.flush();
+            if (n == static_cast<ssize_t>(sizeof(PacketHeader) + h.length) && h.seqNum == h.length &&
+                checksumOf(data, h.length) == h.checksum)
+                replyAndLog(PROBE, h.seqNum, clientAddr);
+            return false;
+        }
+
+        if (h.type == MANIFEST)
+        {
+            loggingStream << h.type << ' ' << h.seqNum << ' ' << h.length << ' ' << h.checksum << '\n';
+            loggingStream.flush();
+            if (dedupEnabled && n == static_cast<ssize_t>(sizeof(PacketHeader) + h.length) &&
+                h.length % dedup::HASH_SIZE == 0 && checksumOf(data, h.length) == h.checksum)
+                handleManifest(flow, h, data, clientAddr);
+            return false;
+        }
+
+        if (h.type == FEC)
+        {
+            loggingStream << h.type << ' ' << h.seqNum << ' ' << h.length << ' ' << h.checksum << '\n';
+            loggingStream.flush();
+            if (fecEnabled && n == static_cast<ssize_t>(sizeof(PacketHeader) + h.length) &&
+                checksumOf(data, h.length) == h.checksum)
+            {
+                storeParity(flow, h.seqNum, data, h.length);
+                fecRecover(flow, h.seqNum, clientAddr);
+            }
+            return false;
+        }
+
+        handleDataPacket(flow, h, data, n, clientAddr);
+        return false;
+    }
+
+    // Event-driven entry point for the simulator: one datagram, in whichever
+    // state the receiver is in.
+    void onDatagram(uint8_t *buf, ssize_t n, sockaddr_in &clientAddr)
+    {
+        if (connection)
+            handleDatagram(buf, n, clientAddr);
+        else
+            handleIdleDatagram(buf, n, clientAddr);
+    }
+
+    // DATA is verified as it is copied to where it is headed (see
+    // landingFor()), so its payload is read once.
+    void handleDataPacket(Flow &flow, const PacketHeader &h, const uint8_t *data, ssize_t n, sockaddr_in &clientAddr)
+    {
+        if (h.type != DATA && !(h.type == CDATA && compressEnabled))
+        {
+            counters.malformed.add();
+            spdlog::debug("Unexpected packet type: {}, expected DATA", h.type);
+            return;
+        }
+
+        if (n != static_cast<ssize_t>(sizeof(PacketHeader) + h.length))
+        {
+            counters.malformed.add();
+            spdlog::debug("Packet length mismatch: expected {}, got {}", sizeof(PacketHeader) + h.length, n);
+            return;
+        }
+
+        uint8_t *landing = h.type == DATA ? landingFor(flow, h.seqNum, h.length) : nullptr;
+        uint32_t sum = (landing ? copyChecksumOf(landing, data, h.length) : checksumOf(data, h.length)) ^ dataKey;
+        if (sum != h.checksum)
+        {
+            counters.crcFailures.add();
+            spdlog::debug("Checksum mismatch for seqNum={}: expected {}, got {}", h.seqNum, h.checksum, sum);
+            return;
+        }
+        if (landing)
+            data = landing;
+
+        loggingStream << h.type << ' ' << h.seqNum << ' ' << h.length << ' ' << h.checksum << '\n';
+        loggingStream.flush();
+        counters.dataPackets.add();
+
+        if (fecEnabled && h.seqNum >= flow.nextExpectedSeqNum && h.seqNum < flow.nextExpectedSeqNum + window_size)
+            flow.fecData[h.seqNum] = {h.type, vector<uint8_t>(data, data + h.length)};
+        deliverPayload(flow, h.seqNum, h.type, data, h.length, clientAddr);
+        if (fecEnabled)
+            fecRecover(flow, h.seqNum, clientAddr);
+    }
+};
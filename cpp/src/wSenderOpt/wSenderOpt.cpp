@@ -1,435 +1,5 @@
-#include <iostream>
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <unistd.h>
-#include <cmath>
-#include <array>
-#include <chrono>
-#include <cstring>
-#include <numeric>
-#include <string>
-#include <vector>
-#include <string.h>
-#include <string>
-#include <cxxopts.hpp>
-#include <spdlog/spdlog.h>
-#include <netdb.h>
-#include <unordered_map>
-#include <unordered_set>
-#include <random>
-#include "../common/Crc32.hpp"
-#include <fstream>
+#include "wSenderOpt.hpp"
 
-using namespace std;
-using Clock = chrono::high_resolution_clock;
-using ms = chrono::milliseconds;
-
-class wSender
-{
-public:
-    string hostname;
-    int port;
-    int window_size;
-    string input_file;
-    string output_log;
-
-    int sockfd = -1;
-    sockaddr_in serverAddr{};
-    socklen_t len = sizeof(serverAddr);
-
-    ofstream outputStream;
-
-    uint32_t firstInWindow = 0;
-    uint32_t nextSeqNum = 0;
-    uint32_t startSeq = 0;
-
-    Clock::time_point endTime{};
-
-    vector<bool> sentPkts;
-    vector<bool> ackdPkts;
-    vector<Clock::time_point> pktDeadlines;
-
-    enum : uint32_t
-    {
-        START = 0,
-        END = 1,
-        DATA = 2,
-        ACK = 3
-    };
-
-    struct PacketHeader
-    {
-        uint32_t type;     // 0: START; 1: END; 2: DATA; 3: ACK
-        uint32_t seqNum;   // Described below
-        uint32_t length;   // Length of data; 0 for ACK packets
-        uint32_t checksum; // 32-bit CRC
-    };
-
-    vector<vector<uint8_t>> dataPkts;
-
-    void ntohl_func(PacketHeader &h)
-    {
-        h.type = ntohl(h.type);
-        h.seqNum = ntohl(h.seqNum);
-        h.length = ntohl(h.length);
-        h.checksum = ntohl(h.checksum);
-    }
-
-    void htonl_func(PacketHeader &h)
-    {
-        h.type = htonl(h.type);
-        h.seqNum = htonl(h.seqNum);
-        h.length = htonl(h.length);
-        h.checksum = htonl(h.checksum);
-    }
-
-    int parseArguments(int argc, char **argv)
-    {
-        cxxopts::Options opts("wSender");
-        opts.add_options()("h,hostname", "The IP address of the host that wReceiver is running on.", cxxopts::value<string>())("p,port", "The port number on which wReceiver is listening", cxxopts::value<int>())("w,window-size", "Maximum number of outstanding packets in the current window.", cxxopts::value<int>())("i,input-file", "Path to the file that has to be transferred. It can be a text file or binary file.", cxxopts::value<string>())("o,output-log", "The file path to which you should log the messages as described above.", cxxopts::value<string>());
-        //-h | --hostname The IP address of the host that wReceiver is running on.
-        // -p | --port The port number on which wReceiver is listening.
-        // -w | --window-size Maximum number of outstanding packets in the current window.
-        // -i | --input-file Path to the file that has to be transferred. It can be a text file or binary file (e.g., image or video).
-        // -o | --output-log The file path to which you should log the messages as described above.
-        // ./wSender -h 127.0.0.1 -p 8000 -w 10 -i input.in -o sender.out
-
-        cxxopts::ParseResult result;
-        try
-        {
-            result = opts.parse(argc, argv);
-        }
-        catch (const exception &e)
-        {
-            cerr << "Error parsing options: " << e.what() << "\n\n"
-                 << opts.help() << "\n";
-            return 1;
-        }
-
-        if (!result.count("hostname") || !result.count("port") || !result.count("input-file") || !result.count("output-log") || !result.count("window-size"))
-        {
-            cerr << "Error: Missing required arguments\n\n"
-                 << opts.help() << "\n";
-            return 1;
-        }
-
-        hostname = result["hostname"].as<string>();
-        port = result["port"].as<int>();
-        window_size = result["window-size"].as<int>();
-        input_file = result["input-file"].as<string>();
-        output_log = result["output-log"].as<string>();
-
-        if (port < 1024 || port > 65535)
-        {
-            spdlog::error("Error: port number must be in the range of [1024, 65535]\n");
-            return 1;
-        }
-
-        outputStream.open(output_log, ios::out | ios::trunc);
-        return 0;
-    }
-
-    void readFile()
-    {
-        ifstream is(input_file, ios::binary);
-        is.seekg(0, ios::end);
-        int length = is.tellg();
-        is.seekg(0, ios::beg);
-
-        vector<unsigned char> buffer(length);
-
-        spdlog::debug("reading {} bytes...", length);
-        is.read(reinterpret_cast<char *>(buffer.data()), length);
-        if (is)
-        {
-            spdlog::debug("all bytes read successfully1.\n");
-        }
-        else
-        {
-            spdlog::debug("error: only {} bytes could be read", static_cast<size_t>(is.gcount()));
-        }
-        is.close();
-
-        spdlog::debug("closed the input file.");
-
-        size_t numChunksNeeded = (length + 1456 - 1) / 1456;
-        dataPkts.resize(numChunksNeeded);
-        sentPkts.assign(numChunksNeeded, false);
-        ackdPkts.assign(numChunksNeeded, false);
-        pktDeadlines.assign(numChunksNeeded, Clock::time_point{});
-        spdlog::debug("Preparing {} data packets...", numChunksNeeded);
-        for (size_t i = 0; i < numChunksNeeded; i++)
-        {
-            spdlog::debug("Preparing packet {}", i);
-            size_t offset = i * 1456;
-            auto pkt = makePacket(DATA, static_cast<uint32_t>(i), buffer.data() + offset, min(static_cast<unsigned int>(1456), static_cast<unsigned int>(length - offset)));
-            dataPkts[i] = pkt;
-            spdlog::debug("Packet {} has total size {} (header {} + payload {})",
-                          i, pkt.size(), sizeof(PacketHeader), pkt.size() - sizeof(PacketHeader));
-        }
-        spdlog::debug("Prepared {} data packets", numChunksNeeded);
-    }
-
-    vector<uint8_t> makePacket(uint32_t type, uint32_t seq, const uint8_t *data, size_t packLen)
-    {
-
-        PacketHeader h{type, seq, static_cast<uint32_t>(packLen), (type == DATA) ? crc32(data, packLen) : 0};
-        htonl_func(h);
-        vector<uint8_t> buff(sizeof(PacketHeader) + packLen);
-        memcpy(buff.data(), &h, sizeof(h));
-        if (packLen > 0)
-            memcpy(buff.data() + sizeof(h), data, packLen);
-        return buff;
-    }
-
-    int createSocket()
-    {
-        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-        if (sockfd < 0)
-        {
-            perror("socket failed");
-            return 1;
-        }
-
-        // 2. Define server address
-        serverAddr.sin_family = AF_INET;
-        serverAddr.sin_port = htons(port);
-        if (inet_pton(AF_INET, hostname.c_str(), &serverAddr.sin_addr) <= 0)
-        {
-            spdlog::error("Invalid address/ Address not supported: {}", hostname);
-            return -1;
-        }
-
-        return 0;
-    }
-
-    void sendData(const vector<uint8_t> &bytes)
-    {
-        size_t currLen = sizeof(serverAddr);
-        int sent = sendto(sockfd, bytes.data(), bytes.size(), 0,
-                          (struct sockaddr *)&serverAddr, currLen);
-        PacketHeader currHeader{};
-        memcpy(&currHeader, bytes.data(), sizeof(currHeader));
-        ntohl_func(currHeader);
-        spdlog::debug("Actually sent {} bytes with seq Num", sent, currHeader.seqNum);
-        outputStream << currHeader.type << ' ' << currHeader.seqNum << ' ' << currHeader.length << ' ' << currHeader.checksum << '\n';
-        outputStream.flush();
-    }
-
-    void sendDataOpt(uint32_t seq)
-    {
-        if (seq >= dataPkts.size())
-            return;
-        sendData(dataPkts[seq]);
-        sentPkts[seq] = true;
-        pktDeadlines[seq] = Clock::now() + ms(500);
-    }
-
-    bool recvData(PacketHeader &ack)
-    {
-        while (true)
-        {
-            socklen_t currLen = sizeof(serverAddr);
-            uint8_t buffer[sizeof(PacketHeader)];
-            ssize_t n = recvfrom(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT,
-                                 (struct sockaddr *)&serverAddr, &currLen);
-
-            if (Clock::now() >= endTime)
-            {
-                return false;
-            }
-            if (n >= static_cast<ssize_t>(sizeof(PacketHeader)))
-            {
-                memcpy(&ack, buffer, sizeof(PacketHeader));
-                ntohl_func(ack);
-                // need to log
-                outputStream << ack.type << ' ' << ack.seqNum << ' '
-                             << ack.length << ' ' << ack.checksum << '\n';
-                outputStream.flush();
-                return true;
-            }
-        }
-    }
-
-    bool recvDataOpt(PacketHeader &ack)
-    {
-        while (true)
-        {
-            socklen_t currLen = sizeof(serverAddr);
-            uint8_t buffer[sizeof(PacketHeader)];
-            ssize_t n = recvfrom(sockfd, buffer, sizeof(buffer), MSG_DONTWAIT,
-                                 (struct sockaddr *)&serverAddr, &currLen);
-            if (n <= 0)
-            {
-                return false;
-            }
-            if (n >= static_cast<ssize_t>(sizeof(PacketHeader)))
-            {
-                memcpy(&ack, buffer, sizeof(PacketHeader));
-                ntohl_func(ack);
-                outputStream << ack.type << ' ' << ack.seqNum << ' ' << ack.length << ' ' << ack.checksum << '\n';
-                outputStream.flush();
-                return true;
-            }
-        }
-    }
-
-    void sendStartPacket()
-    {
-        random_device rd;
-        mt19937 r(rd());
-        uniform_int_distribution<uint32_t> range;
-        startSeq = range(r);
-        vector<uint8_t> startPkt = makePacket(START, startSeq, nullptr, 0);
-        while (true)
-        {
-            sendData(startPkt);
-            endTime = Clock::now() + ms(500);
-            PacketHeader ack{};
-            spdlog::debug("Sent START packet with seq={}", startSeq);
-            if (recvData(ack))
-            {
-                spdlog::debug("Received packet type={}, seqNum={}", ack.type, ack.seqNum);
-                if (ack.type == ACK && ack.seqNum == startSeq)
-                {
-                    spdlog::debug("START handshake complete (seq={})", startSeq);
-                    break;
-                }
-            }
-        }
-    }
-
-    void sendCurrWindow()
-    {
-        while ((firstInWindow + window_size) > nextSeqNum && nextSeqNum < dataPkts.size())
-        {
-            spdlog::debug("Sending DATA packet with size={}", dataPkts[nextSeqNum].size());
-            sendData(dataPkts[nextSeqNum]);
-            nextSeqNum++;
-        }
-        if (firstInWindow < nextSeqNum)
-            endTime = Clock::now() + ms(500);
-    }
-
-    void sendCurrWindowOpt()
-    {
-        if (nextSeqNum < firstInWindow)
-            nextSeqNum = firstInWindow;
-
-        while (nextSeqNum < firstInWindow + window_size && nextSeqNum < dataPkts.size())
-        {
-            if (!sentPkts[nextSeqNum] && !ackdPkts[nextSeqNum])
-            {
-                sendDataOpt(nextSeqNum);
-            }
-            ++nextSeqNum;
-        }
-    }
-
-    void resendCurrWindow()
-    {
-        for (int i = firstInWindow; i < nextSeqNum; i++)
-        {
-            sendData(dataPkts[i]);
-        }
-        endTime = Clock::now() + ms(500);
-    }
-
-    void resendOpt()
-    {
-        auto now = Clock::now();
-        uint32_t endOfWindow = min<uint32_t>(dataPkts.size(), firstInWindow + window_size);
-        for (uint32_t i = firstInWindow; i < endOfWindow; ++i)
-        {
-            if (!ackdPkts[i] && sentPkts[i] && pktDeadlines[i] != Clock::time_point{} && now >= pktDeadlines[i])
-            {
-                spdlog::debug("Timeout for seq {}, retransmitting", i);
-                sendDataOpt(i);
-            }
-        }
-    }
-
-    void sendAllDataPackets()
-    {
-        firstInWindow = 0;
-        nextSeqNum = 0;
-        sendCurrWindow();
-
-        while (firstInWindow < dataPkts.size())
-        {
-            PacketHeader ack{};
-            if (recvData(ack))
-            {
-                if (ack.type != ACK)
-                    continue;
-
-                uint32_t PREV = firstInWindow;
-
-                if (ack.seqNum <= nextSeqNum)
-                {
-                    firstInWindow = std::min(ack.seqNum, nextSeqNum);
-                }
-
-                if (firstInWindow > PREV)
-                {
-                    sendCurrWindow();
-                }
-            }
-            else
-            {
-                spdlog::debug("reached timeout");
-                resendCurrWindow();
-            }
-        }
-    }
-
-    void sendAllDataPacketsOpt()
-    {
-        firstInWindow = 0;
-        nextSeqNum = 0;
-
-        sendCurrWindowOpt();
-
-        while (firstInWindow < dataPkts.size())
-        {
-            PacketHeader ack{};
-            while (recvDataOpt(ack))
-            {
-                spdlog::debug("first in window: {}, dataPkts size is {}", firstInWindow, dataPkts.size());
-                if (ack.type != ACK)
-                    continue;
-                if (ack.seqNum < ackdPkts.size() && !ackdPkts[ack.seqNum])
-                {
-                    ackdPkts[ack.seqNum] = true;
-                    spdlog::debug("ACK received for seq {}", ack.seqNum);
-                }
-            }
-            while (firstInWindow < dataPkts.size() && ackdPkts[firstInWindow])
-            {
-                ++firstInWindow;
-            }
-            sendCurrWindowOpt();
-            resendOpt();
-        }
-    }
-    void sendEndPacket()
-    {
-        vector<uint8_t> endPkt = makePacket(END, startSeq, nullptr, 0);
-        while (true)
-        {
-            sendData(endPkt);
-            endTime = Clock::now() + ms(500);
-            PacketHeader ack{};
-            if (recvData(ack) && ack.type == ACK && ack.seqNum == startSeq)
-            {
-                spdlog::debug("END handshake complete");
-                break;
-            }
-        }
-    }
-};
 int main(int argc, char **argv)
 {
 
@@ -438,17 +8,8 @@ int main(int argc, char **argv)
     spdlog::info("wSender started");
 
     wSender sender;
-    sender.parseArguments(argc, argv);
-    sender.readFile();
-    spdlog::debug("Read file and prepared {} data packets", sender.dataPkts.size());
-    sender.createSocket();
-    spdlog::debug("Socket created");
-    sender.sendStartPacket();
-    spdlog::debug("START packet sent and acknowledged");
-    sender.sendAllDataPacketsOpt();
-    spdlog::debug("All DATA packets sent and acknowledged");
-    sender.sendEndPacket();
-    spdlog::debug("END packet sent and acknowledged");
-
-    return 0;
-}
\ No newline at end of file
+    if (sender.parseArguments(argc, argv))
+        return 1;
+    stats::installDumpSignal();
+    return sender.run();
+}
@@ -0,0 +1,1764 @@
+#pragma once
+
+#include <iostream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <cmath>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <numeric>
+#include <string>
+#include <vector>
+#include <string.h>
+#include <string>
+#include <cxxopts.hpp>
+#include <spdlog/spdlog.h>
+#include <netdb.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <random>
+#include <optional>
+#include <span>
+#include <thread>
+#include <memory>
+#include <filesystem>
+#include <algorithm>
+#include "../common/Batch.hpp"
+#include "../common/Crc32.hpp"
+#include "../common/Crc32c.hpp"
+#include "../common/Compress.hpp"
+#include "../common/CopyChecksum.hpp"
+#include "../common/Dedup.hpp"
+#include "../common/Fec.hpp"
+#include "../common/Histogram.hpp"
+#include "../common/PacketArena.hpp"
+#include "../common/SpscQueue.hpp"
+#include "../common/Stats.hpp"
+#include "../common/StartOptions.hpp"
+#include "../common/Trace.hpp"
+#include "../common/Transport.hpp"
+#include <fstream>
+
+using namespace std;
+using Clock = TimeSource::Clock;
+using ms = chrono::milliseconds;
+
+class wSender
+{
+public:
+    string hostname;
+    int port;
+    int window_size;
+    string input_file;
+    string output_log;
+    int stripes = 1;
+    uint32_t payloadSize = StartOptions::DEFAULT_PAYLOAD; // offered in START, then the negotiated chunk size
+    bool probeMtu = false;
+    Clock::duration handshakeRtt = ms(500);
+
+    bool useFec = false;     // --fec: offer parity packets in START
+    bool fecEnabled = false; // negotiated for this flow
+    uint32_t fecK = 16, fecM = 1;
+    uint32_t fecGroupStart = 0, fecGroupLen = 0;
+    double lossRate = 0;
+    uint32_t sendsSinceAdapt = 0, lossesSinceAdapt = 0;
+
+    bool useCompression = false; // --compress: offer CDATA packets in START
+    unique_ptr<ChunkCompressor> compressor; // set once the receiver accepts
+
+    bool useResume = false;  // --resume: let the receiver keep a partial copy
+    string dedupReference;   // --dedup: file in the receiver's output dir to reuse chunks from
+    bool dedupEnabled = false;
+    uint32_t fixedChunk = 0; // chunk size the receiver set for resume or dedup, 0 otherwise
+
+    bool useFlowControl = false; // --flow-control: ask the receiver to advertise its window
+    bool flowControl = false;    // negotiated for this flow
+    uint32_t rwnd = UINT32_MAX;  // the receiver's window from its latest ACK
+    uint32_t inFlight = 0;       // DATA sent and not yet acknowledged
+    vector<uint8_t> ackPayload;  // reused for every ACK under flow control or SACK
+
+    bool useSack = false;      // --sack: ask the receiver to report what it holds in every ACK
+    bool sackEnabled = false;  // negotiated for this flow
+    uint32_t sackPoint = 0;    // the receiver's in-order point from the latest SACK
+    uint32_t sackMap = 0;      // which of the SACK_SPAN seqNums past sackPoint it holds
+    uint32_t sackFloor = 0;    // everything below has been acknowledged through SACK
+    bool useCrc32c = false;    // --crc32c: offer CRC32C for the packets sent after START
+    uint32_t checksum = StartOptions::CHECKSUM_CRC32; // negotiated for this flow
+
+    // -w auto: start small and grow the window toward the bandwidth-delay
+    // product measured during the transfer, up to windowCap.
+    bool autoWindow = false;
+    uint32_t windowCap = 0;             // -w, or what --max-window-mb holds; lowered to the receiver's grant
+    uint64_t maxWindowBytes = 32 << 20; // --max-window-mb
+    Clock::duration minRtt = Clock::duration::max();
+    Clock::time_point rateSince{};      // start of the current adaptation span
+    double maxRate = 0;                 // highest delivery rate sample in the span, packets/s
+    uint32_t delivered = 0;             // packets first acknowledged so far
+    vector<uint32_t> deliveredAtSend;   // delivered when each packet was first sent
+    static constexpr int AUTO_INITIAL_WINDOW = 16;
+    static constexpr auto MIN_RATE_SPAN = ms(10);
+
+    bool zeroRtt = false;  // --zero-rtt, until the receiver refuses it
+    uint32_t dataKey = 0;  // xored into DATA checksums in a 0-RTT session
+
+    bool prebuild = false;   // --prebuild: packetize the whole input before DATA instead of pipelining
+    int checksumWorkers = 1; // --workers
+
+    bool batchMode = false;           // -i names a directory
+    vector<batch::Entry> batchFiles;  // relative to input_file, in sending order
+
+    // Byte range of the input file carried by this flow; the whole file unless striped.
+    uint64_t fileOffset = 0;
+    uint64_t fileLength = UINT64_MAX;
+
+    optional<StartOptions> startOpts; // offered in START
+    optional<StartOptions> peerOpts;  // what the receiver accepted in its START ACK
+
+    int sockfd = -1;
+    Transport *transport = nullptr; // a UdpTransport on sockfd unless one is injected
+    unique_ptr<Transport> udp;
+    TimeSource *clock = &SystemClock::instance();
+    sockaddr_in serverAddr{};
+    socklen_t len = sizeof(serverAddr);
+
+    ofstream outputStream;
+
+    uint32_t firstInWindow = 0;
+    uint32_t nextSeqNum = 0;
+    uint32_t startSeq = 0;
+
+    Clock::time_point endTime{};
+
+    // Counters for the --stats report, written only by this flow's thread.
+    // Retransmissions are all timeout-driven: WTP has no duplicate-ACK signal.
+    struct SenderStats
+    {
+        stats::Counter datagrams, bytes;       // everything sent
+        stats::Counter dataPackets, retransmits; // first sends and timeout resends of DATA
+        stats::Counter acks, duplicateAcks, staleAcks;
+        stats::Counter fecRepaired;            // ACKs for packets the receiver rebuilt
+        stats::Counter sackAcked;              // packets acknowledged only through SACK
+        stats::Histogram rttUs;
+    };
+    SenderStats counters;
+    vector<const SenderStats *> stripeCounters; // the other stripes', summed into this flow's report
+    string statsPath;                            // --stats; stderr if empty
+    Clock::duration statsInterval{};             // --stats-interval; zero for END and SIGUSR1 only
+    Clock::time_point nextStatsAt{};
+    bool reportsStats = true;                    // false for stripes that stripe 0 reports for
+    Clock::time_point startedAt{};
+
+    unique_ptr<trace::Writer> traceFile; // --trace; stripe flows write through stripe 0's
+    trace::Track trace;
+
+    enum : uint32_t
+    {
+        START = 0,
+        END = 1,
+        DATA = 2,
+        ACK = 3,
+        PROBE = 4, // path MTU probe; seqNum is the payload size being tried
+        FEC = 5,   // parity for a group of DATA packets, see common/Fec.hpp
+        CDATA = 6,   // DATA whose payload is a raw deflate stream, see common/Compress.hpp
+        MANIFEST = 7 // chunk hashes for dedup, see common/Dedup.hpp
+    };
+
+    struct PacketHeader
+    {
+        uint32_t type;     // 0: START; 1: END; 2: DATA; 3: ACK
+        uint32_t seqNum;   // Described below
+        uint32_t length;   // Length of data; 0 for ACK packets
+        uint32_t checksum; // 32-bit CRC
+    };
+
+    // Send state of one DATA packet, packed so a cache line covers four.
+    struct PacketState
+    {
+        Clock::time_point deadline{}; // retransmission time of the last send
+        uint32_t length = 0;          // bytes of the packet in its arena slot
+        bool sent = false;
+        bool acked = false;
+        bool resent = false; // no RTT sample from its ACK (Karn)
+    };
+    static_assert(sizeof(PacketState) == 16);
+
+    vector<PacketState> pkts;
+    PacketArena arena;       // DATA packet i is built in arena.slot(i)
+    bool hugePages = false;  // --huge-pages
+    uint32_t readyCount = 0; // every packet below this is built, or acknowledged and never needed
+
+    // Pipelined send path: a reader thread deals raw chunks round-robin to the
+    // checksum workers over SPSC queues, each worker packetizes (compression
+    // and CRC) into its own output queue, and the network thread drains those
+    // in the same round-robin order, so packets come out in sequence without
+    // locks. The window only reaches packets already collected, and the
+    // network thread collects no further than READ_AHEAD past the window, so
+    // the full queues hold the workers and then the reader back: the arena
+    // commits pages for about window + READ_AHEAD + 2 * PIPELINE_DEPTH per
+    // worker packets at a time, however large the input.
+    static constexpr size_t PIPELINE_DEPTH = 256; // packets per queue
+    static constexpr uint32_t READ_AHEAD = 256;   // packets collected beyond the window
+
+    // A chunk the reader has read into the payload area of its arena slot.
+    struct RawChunk
+    {
+        uint32_t seq = UINT32_MAX; // UINT32_MAX: end of input
+        uint32_t length = 0;
+    };
+
+    struct ChecksumWorker
+    {
+        SpscQueue<RawChunk> in{PIPELINE_DEPTH};
+        SpscQueue<uint32_t> out{PIPELINE_DEPTH}; // lengths of the packets built, in order
+        unique_ptr<ChunkCompressor> compressor; // each worker keeps its own deflate state
+        thread thr;
+    };
+
+    vector<unique_ptr<ChecksumWorker>> workers;
+    thread reader;
+    vector<bool> skipChunks; // acknowledged before DATA; read-only while the pipeline runs
+    size_t nextWorker = 0;   // the worker that builds packet readyCount
+
+    void ntohl_func(PacketHeader &h)
+    {
+        h.type = ntohl(h.type);
+        h.seqNum = ntohl(h.seqNum);
+        h.length = ntohl(h.length);
+        h.checksum = ntohl(h.checksum);
+    }
+
+    void htonl_func(PacketHeader &h)
+    {
+        h.type = htonl(h.type);
+        h.seqNum = htonl(h.seqNum);
+        h.length = htonl(h.length);
+        h.checksum = htonl(h.checksum);
+    }
+
+    int parseArguments(int argc, char **argv)
+    {
+        cxxopts::Options opts("wSender");
+        opts.add_options()("h,hostname", "The IP address of the host that wReceiver is running on.", cxxopts::value<string>())("p,port", "The port number on which wReceiver is listening", cxxopts::value<int>())("w,window-size", "Maximum number of outstanding packets in the current window, or \"auto\" to size it from the measured bandwidth-delay product.", cxxopts::value<string>())("max-window-mb", "Memory cap on one flow's window with -w auto.", cxxopts::value<uint64_t>()->default_value("32"))("i,input-file", "Path to the file that has to be transferred. It can be a text file or binary file.", cxxopts::value<string>())("o,output-log", "The file path to which you should log the messages as described above.", cxxopts::value<string>())("s,stripes", "Number of parallel flows (threads and sockets) the file is striped across.", cxxopts::value<int>()->default_value("1"))("payload-size", "Largest DATA payload to offer the receiver in START.", cxxopts::value<uint32_t>()->default_value("1456"))("probe-mtu", "Probe for the largest datagram the path delivers before sending DATA.", cxxopts::value<bool>()->default_value("false"))("fec", "Send Reed-Solomon parity packets sized to the measured loss rate.", cxxopts::value<bool>()->default_value("false"))("compress", "Deflate each chunk that shrinks, sending the rest raw.", cxxopts::value<bool>()->default_value("false"))("resume", "Make the transfer resumable and skip chunks the receiver kept from an interrupted one.", cxxopts::value<bool>()->default_value("false"))("dedup", "Name of a file in the receiver's output directory; chunks it already holds are not sent.", cxxopts::value<string>()->default_value(""))("zero-rtt", "Send the first window of DATA right behind START instead of waiting for its ACK.", cxxopts::value<bool>()->default_value("false"))("prebuild", "Read and packetize the whole input before sending any DATA.", cxxopts::value<bool>()->default_value("false"))("workers", "Checksum worker threads in the send pipeline.", cxxopts::value<int>()->default_value("1"))("huge-pages", "Back the packet arena with huge pages where the system allows.", cxxopts::value<bool>()->default_value("false"))("flow-control", "Keep no more packets in flight than the window the receiver advertises in its ACKs.", cxxopts::value<bool>()->default_value("false"))("sack", "Have every ACK report all the receiver holds, so a lost ACK causes no retransmission.", cxxopts::value<bool>()->default_value("false"))("crc32c", "Offer CRC32C, computed in hardware where the CPU has it, in place of CRC32.", cxxopts::value<bool>()->default_value("false"))("stats", "Append a JSON summary of the transfer to this file at END and on SIGUSR1; stderr if not given.", cxxopts::value<string>()->default_value(""))("stats-interval", "Also write the summary every this many seconds during the transfer.", cxxopts::value<double>()->default_value("0"))("trace", "Record sends, ACKs, timeouts and window advances to this file as Chrome trace JSON.", cxxopts::value<string>()->default_value(""));
+        //-h | --hostname The IP address of the host that wReceiver is running on.
+        // -p | --port The port number on which wReceiver is listening.
+        // -w | --window-size Maximum number of outstanding packets in the current window.
+        // -i | --input-file Path to the file that has to be transferred. It can be a text file or binary file (e.g., image or video).
+        // -o | --output-log The file path to which you should log the messages as described above.
+        // ./wSender -h 127.0.0.1 -p 8000 -w 10 -i input.in -o sender.out
+
+        cxxopts::ParseResult result;
+        try
+        {
+            result = opts.parse(argc, argv);
+        }
+        catch (const exception &e)
+        {
+            cerr << "Error parsing options: " << e.what() << "\n\n"
+                 << opts.help() << "\n";
+            return 1;
+        }
+
+        if (!result.count("hostname") || !result.count("port") || !result.count("input-file") || !result.count("output-log") || !result.count("window-size"))
+        {
+            cerr << "Error: Missing required arguments\n\n"
+                 << opts.help() << "\n";
+            return 1;
+        }
+
+        hostname = result["hostname"].as<string>();
+        port = result["port"].as<int>();
+        string window = result["window-size"].as<string>();
+        autoWindow = window == "auto";
+        if (!autoWindow)
+        {
+            try
+            {
+                window_size = stoi(window);
+            }
+            catch (const exception &)
+            {
+                window_size = 0;
+            }
+            if (window_size < 1)
+            {
+                spdlog::error("Error: window size must be a positive number or auto\n");
+                return 1;
+            }
+        }
+        maxWindowBytes = result["max-window-mb"].as<uint64_t>() << 20;
+        input_file = result["input-file"].as<string>();
+        output_log = result["output-log"].as<string>();
+        stripes = result["stripes"].as<int>();
+        payloadSize = result["payload-size"].as<uint32_t>();
+        probeMtu = result["probe-mtu"].as<bool>();
+        useFec = result["fec"].as<bool>() && payloadSize > fec::OVERHEAD;
+        useCompression = result["compress"].as<bool>();
+        useResume = result["resume"].as<bool>();
+        useFlowControl = result["flow-control"].as<bool>();
+        useSack = result["sack"].as<bool>();
+        useCrc32c = result["crc32c"].as<bool>();
+        dedupReference = result["dedup"].as<string>();
+        statsPath = result["stats"].as<string>();
+        statsInterval = chrono::duration_cast<Clock::duration>(chrono::duration<double>(max(0.0, result["stats-interval"].as<double>())));
+        prebuild = result["prebuild"].as<bool>();
+        if (autoWindow)
+        {
+            window_size = AUTO_INITIAL_WINDOW;
+            windowCap = autoWindowCap();
+        }
+        else
+            windowCap = window_size;
+        checksumWorkers = result["workers"].as<int>();
+        hugePages = result["huge-pages"].as<bool>();
+        if (filesystem::is_directory(input_file))
+            collectBatch();
+        // Early DATA is cut before the receiver has agreed to anything, so it is plain WTP DATA.
+        zeroRtt = result["zero-rtt"].as<bool>();
+        if (zeroRtt && (batchMode || stripes > 1 || useResume || !dedupReference.empty() || useFec || useCompression ||
+                        useCrc32c || probeMtu || payloadSize != StartOptions::DEFAULT_PAYLOAD))
+        {
+            spdlog::info("--zero-rtt only applies to plain transfers, ignoring it");
+            zeroRtt = false;
+        }
+
+        if (port < 1024 || port > 65535)
+        {
+            spdlog::error("Error: port number must be in the range of [1024, 65535]\n");
+            return 1;
+        }
+
+        if (stripes < 1)
+        {
+            spdlog::error("Error: stripe count must be at least 1\n");
+            return 1;
+        }
+
+        if (checksumWorkers < 1)
+        {
+            spdlog::error("Error: worker count must be at least 1\n");
+            return 1;
+        }
+
+        if (payloadSize < 1 || payloadSize > StartOptions::MAX_PAYLOAD)
+        {
+            spdlog::error("Error: payload size must be in the range of [1, {}]\n", StartOptions::MAX_PAYLOAD);
+            return 1;
+        }
+
+        // START always offers at least the window; a receiver that knows no
+        // options answers with a bare ACK and the transfer is plain WTP.
+        startOpts = makeOffer();
+
+        outputStream.open(output_log, ios::out | ios::trunc);
+        string tracePath = result["trace"].as<string>();
+        if (!tracePath.empty())
+        {
+            traceFile = make_unique<trace::Writer>();
+            if (!traceFile->open(tracePath))
+            {
+                spdlog::error("Error: cannot write trace file {}\n", tracePath);
+                return 1;
+            }
+            traceFile->nameProcess(trace::SENDER_PID, "wSender");
+            traceFile->nameThread(trace::SENDER_PID, 0, "flow 0");
+            trace = {traceFile.get(), trace::SENDER_PID, 0};
+        }
+        return 0;
+    }
+
+    // Batch mode: every regular file under the input directory, sent as one
+    // stream on a single flow. Striping, resume and dedup work on one file.
+    void collectBatch()
+    {
+        batchMode = true;
+        error_code ec;
+        for (filesystem::recursive_directory_iterator it(input_file, ec), end; it != end; it.increment(ec))
+        {
+            if (ec)
+                break;
+            if (!it->is_regular_file(ec))
+                continue;
+            string rel = filesystem::relative(it->path(), input_file, ec).generic_string();
+            if (ec || rel.size() > UINT16_MAX)
+                continue;
+            batchFiles.push_back({rel, it->file_size(ec)});
+        }
+        sort(batchFiles.begin(), batchFiles.end(), [](const batch::Entry &a, const batch::Entry &b)
+             { return a.path < b.path; });
+        if (stripes > 1 || useResume || !dedupReference.empty())
+            spdlog::info("Directory input: ignoring --stripes, --resume and --dedup");
+        stripes = 1;
+        useResume = false;
+        dedupReference.clear();
+        spdlog::debug("Batch of {} files from {}", batchFiles.size(), input_file);
+    }
+
+    StartOptions makeOffer() const
+    {
+        StartOptions opts;
+        opts.sessionId = random_device{}();
+        opts.payloadSize = payloadSize;
+        opts.checksums = StartOptions::CHECKSUM_CRC32 | (useCrc32c ? StartOptions::CHECKSUM_CRC32C : 0);
+        if (useFec)
+            opts.flags |= StartOptions::FLAG_FEC;
+        if (useCompression)
+            opts.flags |= StartOptions::FLAG_COMPRESS;
+        if (useResume)
+        {
+            opts.flags |= StartOptions::FLAG_RESUME;
+            opts.transferId = transferIdOf(input_file);
+        }
+        if (!dedupReference.empty() && dedupReference.size() <= StartOptions::MAX_REFERENCE)
+        {
+            opts.flags |= StartOptions::FLAG_DEDUP;
+            opts.reference = dedupReference;
+        }
+        if (batchMode)
+            opts.flags |= StartOptions::FLAG_BATCH;
+        if (zeroRtt)
+            opts.flags |= StartOptions::FLAG_ZERO_RTT;
+        if (useFlowControl)
+            opts.flags |= StartOptions::FLAG_FLOW_CONTROL;
+        if (useSack)
+            opts.flags |= StartOptions::FLAG_SACK;
+        opts.flags |= StartOptions::FLAG_WINDOW;
+        opts.window = windowCap;
+        if (opts.flags & StartOptions::FILE_FLAGS)
+        {
+            error_code ec;
+            opts.fileSize = filesystem::file_size(input_file, ec);
+        }
+        return opts;
+    }
+
+    // Names the input for --resume. The same path, size and modification time
+    // give the same ID, so an edited file never resumes onto a stale copy.
+    static uint64_t transferIdOf(const string &path)
+    {
+        error_code ec;
+        string name = filesystem::absolute(path, ec).string();
+        uint64_t size = filesystem::file_size(path, ec);
+        int64_t mtime = filesystem::last_write_time(path, ec).time_since_epoch().count();
+        uint64_t hash = 0xcbf29ce484222325; // FNV-1a
+        auto mix = [&hash](const void *p, size_t n)
+        {
+            for (size_t i = 0; i < n; i++)
+                hash = (hash ^ static_cast<const uint8_t *>(p)[i]) * 0x100000001b3;
+        };
+        mix(name.data(), name.size());
+        mix(&size, sizeof(size));
+        mix(&mtime, sizeof(mtime));
+        return hash;
+    }
+
+    // Payload bytes per DATA packet. Parity packets carry a few bytes more than
+    // the data they protect, so FEC shrinks chunks to keep them within payloadSize.
+    uint32_t chunkSize() const
+    {
+        if (fixedChunk)
+            return fixedChunk;
+        return payloadSize - (fecEnabled ? fec::OVERHEAD : 0);
+    }
+
+    // The bytes of this flow's range of the input file.
+    vector<unsigned char> readRange()
+    {
+        ifstream is(input_file, ios::binary);
+        is.seekg(0, ios::end);
+        uint64_t fileSize = is.tellg();
+        fileOffset = min(fileOffset, fileSize);
+        size_t length = min(fileLength, fileSize - fileOffset);
+        is.seekg(fileOffset, ios::beg);
+
+        vector<unsigned char> buffer(length);
+
+        spdlog::debug("reading {} bytes...", length);
+        is.read(reinterpret_cast<char *>(buffer.data()), length);
+        if (is)
+        {
+            spdlog::debug("all bytes read successfully1.\n");
+        }
+        else
+        {
+            spdlog::debug("error: only {} bytes could be read", static_cast<size_t>(is.gcount()));
+        }
+        is.close();
+
+        spdlog::debug("closed the input file.");
+        return buffer;
+    }
+
+    // Batch mode with --prebuild: the whole batch stream.
+    vector<unsigned char> readBatch()
+    {
+        batch::Reader stream(input_file, batchFiles);
+        vector<unsigned char> buffer(stream.size());
+        stream.read(buffer.data(), buffer.size());
+        return buffer;
+    }
+
+    void readFile()
+    {
+        vector<unsigned char> buffer = batchMode ? readBatch() : readRange();
+        size_t length = buffer.size();
+
+        size_t numChunksNeeded = (length + chunkSize() - 1) / chunkSize();
+        allocatePackets(numChunksNeeded);
+        if (fixedChunk && (peerOpts->flags & StartOptions::FLAG_RESUME))
+            markResumedChunks();
+        // Dedup: the receiver's answer decides which chunks need packets at all.
+        if (dedupEnabled)
+            exchangeManifest(buffer.data(), length);
+        spdlog::debug("Preparing {} data packets...", numChunksNeeded);
+        buildPackets(buffer.data(), length);
+        readyCount = static_cast<uint32_t>(numChunksNeeded);
+        spdlog::debug("Prepared {} data packets", numChunksNeeded);
+    }
+
+    // Packetizes every chunk not yet acknowledged into its arena slot. The
+    // chunks are split into one contiguous run per core, and each thread
+    // compresses with its own deflate state.
+    void buildPackets(const uint8_t *data, size_t length)
+    {
+        constexpr size_t MIN_RUN = 256; // chunks; below this a thread costs more than it saves
+        const size_t n = pkts.size();
+        const uint32_t chunk = chunkSize();
+        size_t cores = max<size_t>(1, thread::hardware_concurrency());
+        size_t runs = clamp<size_t>(n / MIN_RUN, 1, cores);
+
+        auto build = [&](size_t first, size_t last)
+        {
+            unique_ptr<ChunkCompressor> deflater = compressor ? make_unique<ChunkCompressor>() : nullptr;
+            for (size_t i = first; i < last; i++)
+            {
+                if (pkts[i].acked)
+                    continue; // the receiver already has it
+                size_t offset = i * chunk;
+                pkts[i].length = static_cast<uint32_t>(buildDataPacket(static_cast<uint32_t>(i), data + offset,
+                                                                       min<size_t>(chunk, length - offset), deflater.get(), arena.slot(i)));
+            }
+        };
+        vector<thread> pool;
+        for (size_t r = 1; r < runs; r++)
+            pool.emplace_back(build, n * r / runs, n * (r + 1) / runs);
+        build(0, n / runs);
+        for (auto &t : pool)
+            t.join();
+        spdlog::debug("Packetized {} chunks on {} threads", n, runs);
+    }
+
+    // Sizes the packet state and the arena for n DATA packets of this flow.
+    void allocatePackets(size_t n)
+    {
+        pkts.assign(n, PacketState{});
+        deliveredAtSend.assign(autoWindow ? n : 0, 0);
+        inFlight = 0;
+        if (!arena.reset(n, sizeof(PacketHeader) + chunkSize(), hugePages))
+            throw bad_alloc();
+        spdlog::debug("Packet arena of {} slots, {} bytes apart", n, arena.slotStride());
+    }
+
+    span<const uint8_t> packet(uint32_t seq) const
+    {
+        return {arena.slot(seq), pkts[seq].length};
+    }
+
+    // Batch streams and dedup manifests need the whole input up front; every
+    // other transfer streams through the pipeline unless --prebuild is given.
+    void prepareData()
+    {
+        if (prebuild || dedupEnabled)
+            readFile();
+        else
+            startPipeline();
+    }
+
+    void startPipeline()
+    {
+        uint64_t length;
+        if (batchMode)
+            length = batch::Reader(input_file, batchFiles).size();
+        else
+        {
+            ifstream is(input_file, ios::binary | ios::ate);
+            uint64_t fileSize = is ? static_cast<uint64_t>(is.tellg()) : 0;
+            fileOffset = min(fileOffset, fileSize);
+            length = min(fileLength, fileSize - fileOffset);
+        }
+
+        size_t numChunksNeeded = (length + chunkSize() - 1) / chunkSize();
+        allocatePackets(numChunksNeeded);
+        if (fixedChunk && (peerOpts->flags & StartOptions::FLAG_RESUME))
+            markResumedChunks();
+        skipChunks.assign(numChunksNeeded, false);
+        for (size_t i = 0; i < numChunksNeeded; i++)
+            skipChunks[i] = pkts[i].acked;
+        readyCount = 0;
+        nextWorker = 0;
+
+        workers.clear();
+        for (int i = 0; i < checksumWorkers; i++)
+        {
+            workers.push_back(make_unique<ChecksumWorker>());
+            if (compressor)
+                workers.back()->compressor = make_unique<ChunkCompressor>();
+        }
+        for (auto &w : workers)
+        {
+            ChecksumWorker *worker = w.get();
+            worker->thr = thread([this, worker]
+                                 { runChecksumWorker(*worker); });
+        }
+        reader = thread([this, length]
+                        { readChunks(length); });
+        spdlog::debug("Pipelining {} data packets through {} checksum workers", numChunksNeeded, workers.size());
+    }
+
+    // Spins briefly, then sleeps, so a stage held up by a slower neighbour
+    // does not burn a core.
+    template <typename Ready>
+    static void waitFor(Ready ready)
+    {
+        for (int spins = 0; !ready(); spins++)
+        {
+            if (spins < 64)
+                this_thread::yield();
+            else
+                this_thread::sleep_for(chrono::microseconds(50));
+        }
+    }
+
+    // Reader stage: the flow's byte range in chunk-sized pieces, read straight
+    // into the payload area of each arena slot, skipping chunks the receiver
+    // already has. A batch is read as its stream, manifest first and then
+    // the files, chunks running across file boundaries; batch mode has no
+    // resume or dedup, so nothing in it is skipped.
+    void readChunks(uint64_t length)
+    {
+        const uint32_t chunk = chunkSize();
+        optional<batch::Reader> stream;
+        vector<char> ioBuffer;
+        ifstream is;
+        if (batchMode)
+            stream.emplace(input_file, batchFiles);
+        else
+        {
+            ioBuffer.resize(1 << 20);
+            is.rdbuf()->pubsetbuf(ioBuffer.data(), static_cast<streamsize>(ioBuffer.size()));
+            is.open(input_file, ios::binary);
+        }
+        bool seek = true;
+        size_t dealt = 0;
+        for (uint32_t seq = 0; seq < skipChunks.size(); seq++)
+        {
+            if (skipChunks[seq])
+            {
+                seek = true;
+                continue;
+            }
+            uint64_t offset = uint64_t(seq) * chunk;
+            RawChunk raw{seq, static_cast<uint32_t>(min<uint64_t>(chunk, length - offset))};
+            uint8_t *payload = arena.slot(seq) + sizeof(PacketHeader);
+            if (stream)
+                stream->read(payload, raw.length);
+            else
+            {
+                if (seek)
+                    is.seekg(static_cast<streamoff>(fileOffset + offset), ios::beg);
+                seek = false;
+                is.read(reinterpret_cast<char *>(payload), raw.length);
+                if (!is)
+                {
+                    // The arena's fresh pages are zero, so the rest goes out as zeros
+                    // rather than stalling the transfer; the sizes stay right.
+                    spdlog::error("Read only {} of {} bytes of chunk {}", static_cast<size_t>(is.gcount()), raw.length, seq);
+                    is.clear();
+                    seek = true;
+                }
+            }
+            ChecksumWorker &w = *workers[dealt++ % workers.size()];
+            waitFor([&]
+                    { return w.in.tryPush(RawChunk(raw)); });
+        }
+        for (auto &w : workers)
+            waitFor([&]
+                    { return w->in.tryPush(RawChunk{}); });
+    }
+
+    // Checksum stage: builds each packet in place around its payload.
+    // Compressing workers deflate the chunk from there into scratch.
+    void runChecksumWorker(ChecksumWorker &w)
+    {
+        vector<uint8_t> scratch(w.compressor ? chunkSize() : 0);
+        RawChunk raw;
+        while (true)
+        {
+            waitFor([&]
+                    { return w.in.tryPop(raw); });
+            if (raw.seq == UINT32_MAX)
+                return;
+            uint8_t *slot = arena.slot(raw.seq);
+            uint32_t built = static_cast<uint32_t>(buildDataPacket(raw.seq, slot + sizeof(PacketHeader), raw.length,
+                                                                   w.compressor.get(), slot, scratch.data()));
+            waitFor([&]
+                    { return w.out.tryPush(uint32_t(built)); });
+        }
+    }
+
+    // Network stage: takes finished packets in sequence order, up to
+    // READ_AHEAD beyond the window.
+    void collectPackets()
+    {
+        const uint64_t limit = min<uint64_t>(pkts.size(), uint64_t(firstInWindow) + window_size + READ_AHEAD);
+        while (readyCount < limit)
+        {
+            if (!skipChunks.empty() && !skipChunks[readyCount])
+            {
+                if (workers.empty() || !workers[nextWorker]->out.tryPop(pkts[readyCount].length))
+                    return;
+                nextWorker = (nextWorker + 1) % workers.size();
+            }
+            readyCount++;
+        }
+    }
+
+    void stopPipeline()
+    {
+        if (reader.joinable())
+            reader.join();
+        for (auto &w : workers)
+            if (w->thr.joinable())
+                w->thr.join();
+        workers.clear();
+        skipChunks.clear();
+    }
+
+    // Marks the chunks the receiver reported in its START ACK as acknowledged.
+    void markResumedChunks()
+    {
+        uint64_t firstChunk = fileOffset / chunkSize();
+        uint64_t lastChunk = firstChunk + pkts.size();
+        size_t skipped = 0;
+        for (const auto &[start, count] : peerOpts->haveRuns)
+        {
+            for (uint64_t c = max<uint64_t>(start, firstChunk); c < min<uint64_t>(uint64_t(start) + count, lastChunk); c++)
+            {
+                pkts[c - firstChunk].acked = true;
+                skipped++;
+            }
+        }
+        spdlog::info("Resuming: the receiver already has {} of {} chunks", skipped, pkts.size());
+    }
+
+    // Dedup: sends a hash of every chunk not yet acknowledged in MANIFEST
+    // packets, up to window_size outstanding with the usual 500 ms timeout,
+    // and marks each chunk the receiver reports it already holds.
+    void exchangeManifest(const uint8_t *data, size_t length)
+    {
+        size_t perPkt = payloadSize / dedup::HASH_SIZE;
+        size_t numPkts = (pkts.size() + perPkt - 1) / perPkt;
+        vector<vector<uint8_t>> manifests(numPkts);
+        vector<bool> answered(numPkts, false);
+        vector<Clock::time_point> deadlines(numPkts);
+        vector<uint8_t> hashes(perPkt * dedup::HASH_SIZE);
+        for (size_t p = 0; p < numPkts; p++)
+        {
+            size_t first = p * perPkt;
+            size_t count = min(perPkt, pkts.size() - first);
+            answered[p] = all_of(pkts.begin() + first, pkts.begin() + first + count, [](const PacketState &st)
+                                 { return st.acked; });
+            if (answered[p])
+                continue;
+            for (size_t i = 0; i < count; i++)
+            {
+                size_t offset = (first + i) * chunkSize();
+                dedup::chunkHash(data + offset, min<size_t>(chunkSize(), length - offset), hashes.data() + i * dedup::HASH_SIZE);
+            }
+            manifests[p] = makePacket(MANIFEST, static_cast<uint32_t>(first), hashes.data(), count * dedup::HASH_SIZE);
+        }
+
+        size_t base = 0, reused = 0;
+        while (true)
+        {
+            while (base < numPkts && answered[base])
+                base++;
+            if (base == numPkts)
+                break;
+            auto current = now();
+            for (size_t p = base; p < min(numPkts, base + window_size); p++)
+            {
+                if (!answered[p] && current >= deadlines[p])
+                {
+                    sendData(manifests[p]);
+                    deadlines[p] = current + ms(500);
+                }
+            }
+            PacketHeader reply{};
+            vector<uint8_t> have;
+            while (recvDataOpt(reply, &have))
+            {
+                size_t p = reply.seqNum / perPkt;
+                if (reply.type != MANIFEST || reply.seqNum % perPkt != 0 || p >= numPkts || answered[p] ||
+                    have.size() != reply.length || crc32(have.data(), have.size()) != reply.checksum)
+                    continue;
+                size_t count = min(perPkt, pkts.size() - reply.seqNum);
+                if (have.size() != (count + 7) / 8)
+                    continue;
+                for (size_t i = 0; i < count; i++)
+                {
+                    if ((have[i / 8] >> (i % 8)) & 1 && !pkts[reply.seqNum + i].acked)
+                    {
+                        pkts[reply.seqNum + i].acked = true;
+                        reused++;
+                    }
+                }
+                answered[p] = true;
+            }
+        }
+        spdlog::info("Dedup: the receiver reused {} of {} chunks", reused, pkts.size());
+    }
+
+    vector<uint8_t> makePacket(uint32_t type, uint32_t seq, const uint8_t *data, size_t packLen)
+    {
+        vector<uint8_t> buff(sizeof(PacketHeader) + packLen);
+        uint8_t *payload = buff.data() + sizeof(PacketHeader);
+        // START goes out before a checksum is agreed, and again for each file of a batch.
+        uint32_t sum = packLen == 0 ? 0 : type == START ? crc32Copy(payload, data, packLen) : copyChecksumOf(payload, data, packLen);
+        PacketHeader h{type, seq, static_cast<uint32_t>(packLen), sum};
+        htonl_func(h);
+        memcpy(buff.data(), &h, sizeof(h));
+        return buff;
+    }
+
+    // Writes a DATA packet, or a CDATA packet when deflater is given and the
+    // chunk shrinks, to out, which has room for the header and packLen bytes;
+    // returns the packet's length. data may already sit at out's payload;
+    // otherwise it is checksummed as it is copied there. Deflate writes
+    // straight into the payload, so the chunk is compressed in the same pass
+    // that packetizes it. It cannot write over its own input, though: a
+    // chunk already at the payload is deflated into deflated, with room for
+    // packLen bytes, and copied back only if it shrank. In a 0-RTT session
+    // the checksum is keyed with dataKey.
+    size_t buildDataPacket(uint32_t seq, const uint8_t *data, size_t packLen, ChunkCompressor *deflater, uint8_t *out,
+                           uint8_t *deflated = nullptr)
+    {
+        uint8_t *payload = out + sizeof(PacketHeader);
+        uint8_t *target = data == payload ? deflated : payload;
+        uint32_t type = CDATA;
+        size_t wireLen = deflater ? deflater->compress(data, packLen, target) : 0;
+        uint32_t sum;
+        if (wireLen == 0)
+        {
+            type = DATA;
+            wireLen = packLen;
+            sum = data != payload ? copyChecksumOf(payload, data, packLen) : checksumOf(payload, packLen);
+        }
+        else
+            sum = target != payload ? copyChecksumOf(payload, target, wireLen) : checksumOf(payload, wireLen);
+        PacketHeader h{type, seq, static_cast<uint32_t>(wireLen), sum ^ dataKey};
+        htonl_func(h);
+        memcpy(out, &h, sizeof(h));
+        return sizeof(PacketHeader) + wireLen;
+    }
+
+    // The negotiated checksum of what this flow sends after START; the
+    // receiver's replies always carry CRC32.
+    uint32_t checksumOf(const uint8_t *data, size_t length) const
+    {
+        return checksum == StartOptions::CHECKSUM_CRC32C ? crc32c(data, length) : crc32(data, length);
+    }
+
+    // checksumOf() of data, taken while copying it to dst.
+    uint32_t copyChecksumOf(uint8_t *dst, const uint8_t *data, size_t length) const
+    {
+        return checksum == StartOptions::CHECKSUM_CRC32C ? crc32cCopy(dst, data, length) : crc32Copy(dst, data, length);
+    }
+
+    Clock::time_point now()
+    {
+        return clock->now();
+    }
+
+    int createSocket()
+    {
+        if (transport)
+            return 0; // injected, e.g. by the simulator
+        sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (sockfd < 0)
+        {
+            perror("socket failed");
+            return 1;
+        }
+
+        // 2. Define server address
+        serverAddr.sin_family = AF_INET;
+        serverAddr.sin_port = htons(port);
+        if (inet_pton(AF_INET, hostname.c_str(), &serverAddr.sin_addr) <= 0)
+        {
+            spdlog::error("Invalid address/ Address not supported: {}", hostname);
+            return -1;
+        }
+        udp = make_unique<UdpTransport>(sockfd);
+        transport = udp.get();
+
+        return 0;
+    }
+
+    ssize_t sendData(span<const uint8_t> bytes)
+    {
+        ssize_t sent = transport->sendTo(bytes.data(), bytes.size(), serverAddr);
+        counters.datagrams.add();
+        if (sent > 0)
+            counters.bytes.add(static_cast<uint64_t>(sent));
+        PacketHeader currHeader{};
+        memcpy(&currHeader, bytes.data(), sizeof(currHeader));
+        ntohl_func(currHeader);
+        spdlog::debug("Actually sent {} bytes with seq Num", sent, currHeader.seqNum);
+        outputStream << currHeader.type << ' ' << currHeader.seqNum << ' ' << currHeader.length << ' ' << currHeader.checksum << '\n';
+        outputStream.flush();
+        return sent;
+    }
+
+    void sendDataOpt(uint32_t seq)
+    {
+        if (seq >= pkts.size())
+            return;
+        sendData(packet(seq));
+        if (pkts[seq].sent)
+        {
+            pkts[seq].resent = true;
+            counters.retransmits.add();
+        }
+        else
+        {
+            counters.dataPackets.add();
+            inFlight++;
+            if (autoWindow)
+                deliveredAtSend[seq] = delivered;
+        }
+        auto sentAt = now();
+        if (trace)
+            trace.instant("send", sentAt, {{"seq", seq}, {"retransmit", pkts[seq].sent}});
+        pkts[seq].sent = true;
+        pkts[seq].deadline = sentAt + ms(500);
+    }
+
+    bool recvData(PacketHeader &ack, vector<uint8_t> *payload = nullptr)
+    {
+        while (true)
+        {
+            uint8_t buffer[sizeof(PacketHeader) + 1456];
+            ssize_t n = transport->recvFrom(buffer, sizeof(buffer), serverAddr, false);
+
+            if (now() >= endTime)
+            {
+                return false;
+            }
+            if (n >= static_cast<ssize_t>(sizeof(PacketHeader)))
+            {
+                memcpy(&ack, buffer, sizeof(PacketHeader));
+                ntohl_func(ack);
+                // need to log
+                outputStream << ack.type << ' ' << ack.seqNum << ' '
+                             << ack.length << ' ' << ack.checksum << '\n';
+                outputStream.flush();
+                if (payload)
+                    payload->assign(buffer + sizeof(PacketHeader), buffer + n);
+                return true;
+            }
+        }
+    }
+
+    bool recvDataOpt(PacketHeader &ack, vector<uint8_t> *payload = nullptr)
+    {
+        while (true)
+        {
+            uint8_t buffer[sizeof(PacketHeader) + 1456];
+            ssize_t n = transport->recvFrom(buffer, sizeof(buffer), serverAddr, false);
+            if (n <= 0)
+            {
+                return false;
+            }
+            if (n >= static_cast<ssize_t>(sizeof(PacketHeader)))
+            {
+                memcpy(&ack, buffer, sizeof(PacketHeader));
+                ntohl_func(ack);
+                outputStream << ack.type << ' ' << ack.seqNum << ' ' << ack.length << ' ' << ack.checksum << '\n';
+                outputStream.flush();
+                if (payload)
+                    payload->assign(buffer + sizeof(PacketHeader), buffer + n);
+                return true;
+            }
+        }
+    }
+
+    void sendStartPacket()
+    {
+        random_device rd;
+        mt19937 r(rd());
+        uniform_int_distribution<uint32_t> range;
+        startSeq = range(r);
+        vector<uint8_t> opts = startOpts ? startOpts->encode() : vector<uint8_t>{};
+        vector<uint8_t> startPkt = makePacket(START, startSeq, opts.data(), opts.size());
+        bool first = true;
+        while (true)
+        {
+            sendData(startPkt);
+            auto sentAt = now();
+            endTime = sentAt + ms(500);
+            PacketHeader ack{};
+            vector<uint8_t> payload;
+            spdlog::debug("Sent START packet with seq={}", startSeq);
+            if (zeroRtt && first)
+            {
+                // 0-RTT: the first window goes out now; lost packets time out as usual.
+                firstInWindow = nextSeqNum = 0;
+                sendCurrWindowOpt();
+            }
+            first = false;
+            while (recvData(ack, &payload))
+            {
+                spdlog::debug("Received packet type={}, seqNum={}", ack.type, ack.seqNum);
+                if (zeroRtt && ack.type == ACK && ack.seqNum != startSeq && ack.seqNum < pkts.size())
+                {
+                    markAcked(ack.seqNum); // overtook the START ACK
+                    continue;
+                }
+                if (ack.type == ACK && ack.seqNum == startSeq)
+                {
+                    // A receiver without extensions answers with a bare ACK.
+                    StartOptions accepted;
+                    if (startOpts && ack.length > 0 && payload.size() == ack.length &&
+                        crc32(payload.data(), payload.size()) == ack.checksum &&
+                        accepted.decode(payload.data(), payload.size()))
+                    {
+                        peerOpts = accepted;
+                    }
+                    handshakeRtt = now() - sentAt;
+                    spdlog::debug("START handshake complete (seq={})", startSeq);
+                    return;
+                }
+            }
+        }
+    }
+
+    // 0-RTT: cuts the file into plain DATA keyed with the session ID before
+    // START, so the first window can follow it immediately.
+    void prepareZeroRtt()
+    {
+        dataKey = startOpts->sessionId;
+        readFile();
+    }
+
+    // PLPMTUD-style search (RFC 8899): with DF set, walk down a ladder of common
+    // path MTUs and keep the first size whose padded PROBE the receiver echoes.
+    // A size the local interface cannot carry fails at sendto() straight away.
+    uint32_t probePayloadSize(uint32_t limit)
+    {
+#ifdef IP_MTU_DISCOVER
+        int pmtud = IP_PMTUDISC_DO;
+        setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &pmtud, sizeof(pmtud));
+#endif
+        constexpr uint32_t overhead = 28 + sizeof(PacketHeader); // IPv4 + UDP + WTP headers
+        const uint32_t ladder[] = {limit, 9000 - overhead, 4352 - overhead};
+        auto timeout = min<Clock::duration>(ms(500), max<Clock::duration>(ms(20), 3 * handshakeRtt));
+        vector<uint8_t> padding(limit, 0);
+
+        for (uint32_t size : ladder)
+        {
+            if (size > limit || size <= StartOptions::DEFAULT_PAYLOAD)
+                continue;
+            vector<uint8_t> probe = makePacket(PROBE, size, padding.data(), size);
+            for (int attempt = 0; attempt < 3; attempt++)
+            {
+                if (sendData(probe) < 0)
+                {
+                    spdlog::debug("Probe of {} bytes rejected locally", size);
+                    break;
+                }
+                endTime = now() + timeout;
+                PacketHeader reply{};
+                while (recvData(reply))
+                {
+                    if (reply.type == PROBE && reply.seqNum == size)
+                    {
+                        spdlog::debug("Path carries {}-byte payloads", size);
+                        return size;
+                    }
+                }
+            }
+        }
+        spdlog::debug("No probe succeeded, using {}-byte payloads", StartOptions::DEFAULT_PAYLOAD);
+        return min(limit, StartOptions::DEFAULT_PAYLOAD);
+    }
+
+    void applyPeerOptions()
+    {
+        if (zeroRtt && !(peerOpts && (peerOpts->flags & StartOptions::FLAG_ZERO_RTT)))
+        {
+            // Early DATA is dead: its keyed checksums fail at this receiver.
+            spdlog::info("Receiver refused 0-RTT, sending the file normally");
+            zeroRtt = false;
+            dataKey = 0;
+        }
+        checksum = peerOpts ? peerOpts->checksums : StartOptions::CHECKSUM_CRC32;
+        if (!has_single_bit(checksum) || !(checksum & (startOpts ? startOpts->checksums : StartOptions::CHECKSUM_CRC32)))
+        {
+            spdlog::error("Receiver chose a checksum we did not offer ({:#x}), using CRC32", checksum);
+            checksum = StartOptions::CHECKSUM_CRC32;
+        }
+        payloadSize = peerOpts ? peerOpts->payloadSize : StartOptions::DEFAULT_PAYLOAD;
+        bool fixed = peerOpts && (peerOpts->flags & StartOptions::FILE_FLAGS);
+        // Resume and dedup work in the receiver's chunks, so keep the agreed payload.
+        if (probeMtu && peerOpts && !fixed)
+            payloadSize = probePayloadSize(payloadSize);
+        fecEnabled = peerOpts && (peerOpts->flags & StartOptions::FLAG_FEC) && payloadSize > fec::OVERHEAD;
+        flowControl = peerOpts && (peerOpts->flags & StartOptions::FLAG_FLOW_CONTROL);
+        rwnd = UINT32_MAX;
+        sackEnabled = peerOpts && (peerOpts->flags & StartOptions::FLAG_SACK);
+        fixedChunk = fixed ? peerOpts->chunkSize : 0;
+        if (fixedChunk + (fecEnabled ? fec::OVERHEAD : 0) > payloadSize)
+        {
+            spdlog::error("Receiver chose an unusable chunk size {}, not resuming or deduplicating", fixedChunk);
+            fixedChunk = 0;
+            peerOpts->flags &= ~StartOptions::FILE_FLAGS;
+        }
+        dedupEnabled = fixedChunk && (peerOpts->flags & StartOptions::FLAG_DEDUP) && payloadSize >= dedup::HASH_SIZE;
+        if (peerOpts && (peerOpts->flags & StartOptions::FLAG_COMPRESS))
+            compressor = make_unique<ChunkCompressor>();
+        // A receiver that grants no window may hold no more than it was
+        // sent before, so -w auto stays where it started.
+        if (peerOpts && (peerOpts->flags & StartOptions::FLAG_WINDOW))
+            windowCap = min(windowCap, peerOpts->window);
+        else if (autoWindow)
+            windowCap = min<uint32_t>(windowCap, window_size);
+        if (autoWindow)
+            windowCap = min(windowCap, autoWindowCap()); // the payload may have grown since the offer
+        window_size = static_cast<int>(min<uint32_t>(window_size, windowCap));
+        sizeSendBuffer();
+        spdlog::debug("Using {}-byte DATA payloads, FEC {}, compression {}, window {} of at most {}", payloadSize,
+                      fecEnabled ? "on" : "off", compressor ? "on" : "off", window_size, windowCap);
+    }
+
+    // Packets of the current payload size that fit in --max-window-mb.
+    uint32_t autoWindowCap() const
+    {
+        return static_cast<uint32_t>(clamp<uint64_t>(maxWindowBytes / (sizeof(PacketHeader) + payloadSize), 1, INT32_MAX));
+    }
+
+    // Lets the socket queue a whole window of datagrams, with the same
+    // headroom for per-datagram overhead the receiver allows.
+    void sizeSendBuffer()
+    {
+        if (sockfd < 0)
+            return;
+        uint64_t wanted = 2 * uint64_t(window_size) * (sizeof(PacketHeader) + payloadSize);
+        int current = 0;
+        socklen_t optlen = sizeof(current);
+        getsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &current, &optlen);
+        if (wanted > static_cast<uint64_t>(current))
+        {
+            int sndbuf = static_cast<int>(min<uint64_t>(INT32_MAX, wanted));
+            setsockopt(sockfd, SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+        }
+    }
+
+    // -w auto: every few RTTs, raises the window to twice the bandwidth-delay
+    // product, taken as the best delivery rate sampled over that span times
+    // the lowest RTT seen. While the window is what limits the rate, the
+    // product tracks the window and the window doubles; once the path is the
+    // limit, the rate stops rising and the window settles. It never shrinks:
+    // losses are already paced by the retransmission timeout. Each sample
+    // spans one packet's RTT, so the time the window spends stuck behind a
+    // loss until its timeout does not drag the rate down.
+    void adaptWindow()
+    {
+        auto current = now();
+        if (rateSince == Clock::time_point{})
+        {
+            rateSince = current;
+            maxRate = 0;
+            return;
+        }
+        auto span = current - rateSince;
+        if (minRtt == Clock::duration::max() || span < max<Clock::duration>(4 * minRtt, MIN_RATE_SPAN))
+            return;
+        double rate = maxRate;
+        double bdp = rate * chrono::duration<double>(minRtt).count();
+        rateSince = current;
+        maxRate = 0;
+        uint32_t target = static_cast<uint32_t>(min<double>(windowCap, ceil(2 * bdp)));
+        if (target <= static_cast<uint32_t>(window_size))
+            return;
+        spdlog::debug("Window {} -> {} at {:.0f} packets/s, min RTT {} us", window_size, target, rate,
+                      chrono::duration_cast<chrono::microseconds>(minRtt).count());
+        window_size = static_cast<int>(target);
+        sizeSendBuffer();
+        if (trace)
+            trace.counter("window", current, window_size);
+    }
+
+    // Sends the parity of DATA packets [start, start + k) right behind them.
+    void sendParity(uint32_t start, uint32_t k)
+    {
+        size_t maxLen = 0;
+        for (uint32_t i = start; i < start + k; i++)
+            maxLen = max(maxLen, packet(i).size() - sizeof(PacketHeader));
+        size_t symLen = 3 + maxLen;
+
+        vector<vector<uint8_t>> symbols(k, vector<uint8_t>(symLen));
+        vector<const uint8_t *> dataPtrs(k);
+        for (uint32_t i = 0; i < k; i++)
+        {
+            span<const uint8_t> pkt = packet(start + i);
+            PacketHeader h{};
+            memcpy(&h, pkt.data(), sizeof(h));
+            fec::makeSymbol(symbols[i].data(), symLen, ntohl(h.type), pkt.data() + sizeof(PacketHeader), pkt.size() - sizeof(PacketHeader));
+            dataPtrs[i] = symbols[i].data();
+        }
+
+        vector<vector<uint8_t>> parity(fecM, vector<uint8_t>(sizeof(fec::FecHeader) + symLen));
+        vector<uint8_t *> parityPtrs(fecM);
+        for (uint32_t j = 0; j < fecM; j++)
+        {
+            fec::FecHeader fh{static_cast<uint8_t>(k), static_cast<uint8_t>(fecM), static_cast<uint8_t>(j), 0};
+            memcpy(parity[j].data(), &fh, sizeof(fh));
+            parityPtrs[j] = parity[j].data() + sizeof(fh);
+        }
+        fec::encode(k, fecM, dataPtrs.data(), parityPtrs.data(), symLen);
+        for (uint32_t j = 0; j < fecM; j++)
+            sendData(makePacket(FEC, start, parity[j].data(), parity[j].size()));
+    }
+
+    // Groups first transmissions into runs of fecK consecutive packets and
+    // sends parity when a run is complete, breaks, or reaches the end of the
+    // file. Every 256 packets the group shape is re-picked from the loss rate
+    // (timeouts plus packets the receiver reports as rebuilt).
+    void fecOnFirstSend(uint32_t seq)
+    {
+        if (fecGroupLen > 0 && seq != fecGroupStart + fecGroupLen)
+        {
+            sendParity(fecGroupStart, fecGroupLen);
+            fecGroupLen = 0;
+        }
+        if (fecGroupLen == 0)
+            fecGroupStart = seq;
+        fecGroupLen++;
+        sendsSinceAdapt++;
+        if (fecGroupLen < fecK && seq + 1 < pkts.size())
+            return;
+
+        sendParity(fecGroupStart, fecGroupLen);
+        fecGroupLen = 0;
+        if (sendsSinceAdapt >= 256)
+        {
+            lossRate = 0.75 * lossRate + 0.25 * (static_cast<double>(lossesSinceAdapt) / sendsSinceAdapt);
+            sendsSinceAdapt = lossesSinceAdapt = 0;
+            fec::chooseGroup(lossRate, fecK, fecM);
+            fecK = max<uint32_t>(1, min<uint32_t>(fecK, window_size));
+            spdlog::debug("Loss rate {:.4f}, FEC groups of {} + {}", lossRate, fecK, fecM);
+        }
+    }
+
+    void sendCurrWindow()
+    {
+        while ((firstInWindow + window_size) > nextSeqNum && nextSeqNum < pkts.size())
+        {
+            spdlog::debug("Sending DATA packet with size={}", packet(nextSeqNum).size());
+            sendData(packet(nextSeqNum));
+            nextSeqNum++;
+        }
+        if (firstInWindow < nextSeqNum)
+            endTime = now() + ms(500);
+    }
+
+    void sendCurrWindowOpt()
+    {
+        if (nextSeqNum < firstInWindow)
+            nextSeqNum = firstInWindow;
+
+        // In flight are at most window_size packets (the window is only that
+        // wide) and at most rwnd.
+        while (nextSeqNum < firstInWindow + window_size && nextSeqNum < readyCount)
+        {
+            if (!pkts[nextSeqNum].sent && !pkts[nextSeqNum].acked)
+            {
+                if (inFlight >= rwnd)
+                    break;
+                sendDataOpt(nextSeqNum);
+                if (fecEnabled)
+                    fecOnFirstSend(nextSeqNum);
+            }
+            ++nextSeqNum;
+        }
+    }
+
+    void resendCurrWindow()
+    {
+        for (uint32_t i = firstInWindow; i < nextSeqNum; i++)
+        {
+            sendData(packet(i));
+        }
+        endTime = now() + ms(500);
+    }
+
+    void resendOpt()
+    {
+        auto current = now();
+        uint32_t endOfWindow = min<uint32_t>(pkts.size(), firstInWindow + window_size);
+        for (uint32_t i = firstInWindow; i < endOfWindow; ++i)
+        {
+            const PacketState &st = pkts[i];
+            if (!st.acked && st.sent && st.deadline != Clock::time_point{} && current >= st.deadline)
+            {
+                spdlog::debug("Timeout for seq {}, retransmitting", i);
+                if (trace)
+                    trace.instant("timeout", current, {{"seq", i}});
+                lossesSinceAdapt++;
+                sendDataOpt(i);
+            }
+        }
+    }
+
+    void sendAllDataPackets()
+    {
+        firstInWindow = 0;
+        nextSeqNum = 0;
+        sendCurrWindow();
+
+        while (firstInWindow < pkts.size())
+        {
+            PacketHeader ack{};
+            if (recvData(ack))
+            {
+                if (ack.type != ACK)
+                    continue;
+
+                uint32_t PREV = firstInWindow;
+
+                if (ack.seqNum <= nextSeqNum)
+                {
+                    firstInWindow = std::min(ack.seqNum, nextSeqNum);
+                }
+
+                if (firstInWindow > PREV)
+                {
+                    sendCurrWindow();
+                }
+            }
+            else
+            {
+                spdlog::debug("reached timeout");
+                resendCurrWindow();
+            }
+        }
+    }
+
+    void sendAllDataPacketsOpt()
+    {
+        firstInWindow = 0;
+        nextSeqNum = 0;
+        sackFloor = 0;
+
+        collectPackets();
+        sendCurrWindowOpt();
+
+        while (firstInWindow < pkts.size())
+        {
+            collectPackets();
+            PacketHeader ack{};
+            bool heard = false;
+            while (recvDataOpt(ack, (flowControl || sackEnabled) ? &ackPayload : nullptr))
+            {
+                heard = true;
+                spdlog::debug("first in window: {}, {} packets", firstInWindow, pkts.size());
+                if (ack.type != ACK)
+                    continue;
+                counters.acks.add();
+                if (trace)
+                    trace.instant("ack", now(), {{"seq", ack.seqNum}});
+                if (ack.seqNum >= pkts.size())
+                {
+                    counters.staleAcks.add(); // e.g. a late START ACK
+                    continue;
+                }
+                size_t prefix = (flowControl || sackEnabled) ? readAckExtras(ack) : 0;
+                if (pkts[ack.seqNum].acked)
+                    counters.duplicateAcks.add();
+                else
+                {
+                    if (fecEnabled && ack.length == prefix + fec::REPAIRED_ACK_LENGTH)
+                    {
+                        lossesSinceAdapt++;
+                        counters.fecRepaired.add();
+                    }
+                    recordRtt(pkts[ack.seqNum]);
+                    recordDelivery(ack.seqNum);
+                    markAcked(ack.seqNum);
+                    spdlog::debug("ACK received for seq {}", ack.seqNum);
+                }
+                if (sackEnabled && prefix)
+                    applySack();
+            }
+            if (heard && autoWindow)
+                adaptWindow();
+            if (reportsStats)
+                pollStats();
+            uint32_t before = firstInWindow;
+            while (firstInWindow < pkts.size() && pkts[firstInWindow].acked)
+            {
+                ++firstInWindow;
+            }
+            if (trace && firstInWindow != before)
+                trace.counter("firstInWindow", now(), firstInWindow);
+            // Nothing below the window is sent again, except members of an
+            // FEC group whose parity is still to come.
+            arena.release(fecGroupLen ? min(firstInWindow, fecGroupStart) : firstInWindow);
+            sendCurrWindowOpt();
+            resendOpt();
+            // Polling for ACKs must not starve the reader and workers.
+            if (!heard && !workers.empty())
+                this_thread::yield();
+        }
+        stopPipeline();
+    }
+    void markAcked(uint32_t seq)
+    {
+        if (pkts[seq].sent && !pkts[seq].acked)
+            inFlight--;
+        pkts[seq].acked = true;
+    }
+
+    // Takes the receiver's window and SACK block from the front of a DATA
+    // ACK and returns how many bytes of its payload they were, so what
+    // follows can be read; 0 if the payload is damaged.
+    size_t readAckExtras(const PacketHeader &ack)
+    {
+        size_t prefix = (flowControl ? StartOptions::RWND_SIZE : 0) + (sackEnabled ? StartOptions::SACK_SIZE : 0);
+        if (ack.length < prefix || ackPayload.size() != ack.length ||
+            crc32(ackPayload.data(), ackPayload.size()) != ack.checksum)
+            return 0;
+        const uint8_t *p = ackPayload.data();
+        if (flowControl)
+        {
+            uint32_t advertised = wordAt(p);
+            if (trace && advertised != rwnd)
+                trace.counter("rwnd", now(), advertised);
+            rwnd = advertised;
+            p += StartOptions::RWND_SIZE;
+        }
+        if (sackEnabled)
+        {
+            sackPoint = wordAt(p);
+            sackMap = wordAt(p + sizeof(uint32_t));
+        }
+        return prefix;
+    }
+
+    static uint32_t wordAt(const uint8_t *p)
+    {
+        uint32_t w;
+        memcpy(&w, p, sizeof(w));
+        return ntohl(w);
+    }
+
+    // Acknowledges everything the latest SACK reports the receiver holds.
+    void applySack()
+    {
+        uint32_t end = min<uint32_t>(sackPoint, pkts.size());
+        for (uint32_t s = max(firstInWindow, sackFloor); s < end; s++)
+            ackBySack(s);
+        sackFloor = max(sackFloor, end);
+        for (uint32_t bits = sackMap; bits; bits &= bits - 1)
+        {
+            uint64_t s = uint64_t(sackPoint) + 1 + countr_zero(bits);
+            if (s < pkts.size())
+                ackBySack(static_cast<uint32_t>(s));
+        }
+    }
+
+    void ackBySack(uint32_t seq)
+    {
+        if (pkts[seq].acked)
+            return;
+        if (pkts[seq].sent)
+        {
+            counters.sackAcked.add();
+            recordDelivery(seq);
+        }
+        markAcked(seq);
+    }
+
+    // An RTT sample from a packet's only transmission; its send time is
+    // the deadline less the fixed timeout.
+    void recordRtt(const PacketState &st)
+    {
+        if (!st.sent || st.resent)
+            return;
+        auto rtt = now() - (st.deadline - ms(500));
+        minRtt = min(minRtt, rtt);
+        counters.rttUs.record(static_cast<uint64_t>(max<int64_t>(0, chrono::duration_cast<chrono::microseconds>(rtt).count())));
+    }
+
+    // Counts a packet's first acknowledgement and, for -w auto, takes a
+    // delivery rate sample from it: the packets delivered while it was in
+    // flight, over its RTT. Only its only transmission gives one.
+    void recordDelivery(uint32_t seq)
+    {
+        delivered++;
+        const PacketState &st = pkts[seq];
+        if (!autoWindow || !st.sent || st.resent)
+            return;
+        double rtt = chrono::duration<double>(now() - (st.deadline - ms(500))).count();
+        if (rtt > 0)
+            maxRate = max(maxRate, (delivered - deliveredAtSend[seq]) / rtt);
+    }
+
+    // The report for this flow and, when striped, all the others.
+    string statsJson(const char *event)
+    {
+        uint64_t datagrams = 0, bytes = 0, dataPackets = 0, retransmits = 0, acks = 0, duplicateAcks = 0, staleAcks = 0;
+        uint64_t fecRepaired = 0, sackAcked = 0;
+        stats::Histogram rttUs;
+        vector<const SenderStats *> all{&counters};
+        all.insert(all.end(), stripeCounters.begin(), stripeCounters.end());
+        for (const SenderStats *c : all)
+        {
+            datagrams += c->datagrams.get();
+            bytes += c->bytes.get();
+            dataPackets += c->dataPackets.get();
+            retransmits += c->retransmits.get();
+            acks += c->acks.get();
+            duplicateAcks += c->duplicateAcks.get();
+            staleAcks += c->staleAcks.get();
+            fecRepaired += c->fecRepaired.get();
+            sackAcked += c->sackAcked.get();
+            rttUs.merge(c->rttUs);
+        }
+        double elapsed = chrono::duration<double>(now() - startedAt).count();
+        return stats::JsonObject()
+            .field("role", string("sender"))
+            .field("event", string(event))
+            .field("elapsed_s", elapsed)
+            .field("stripes", static_cast<uint64_t>(all.size()))
+            .field("packets_sent", datagrams)
+            .field("bytes_sent", bytes)
+            .field("data_packets", dataPackets)
+            .field("retransmits_timeout", retransmits)
+            .field("acks", acks)
+            .field("duplicate_acks", duplicateAcks)
+            .field("stale_acks", staleAcks)
+            .field("fec_repaired", fecRepaired)
+            .field("sack_acked", sackAcked)
+            .raw("rtt_us", rttUs.json())
+            .str();
+    }
+
+    // Writes the report if SIGUSR1 arrived or the next interval is due.
+    void pollStats()
+    {
+        if (stats::dumpPending())
+            writeStats("signal");
+        if (statsInterval > Clock::duration::zero())
+        {
+            auto current = now();
+            if (nextStatsAt == Clock::time_point{})
+                nextStatsAt = current + statsInterval;
+            else if (current >= nextStatsAt)
+            {
+                writeStats("interval");
+                nextStatsAt = current + statsInterval;
+            }
+        }
+    }
+
+    void writeStats(const char *event)
+    {
+        stats::write(statsPath, statsJson(event));
+    }
+
+    void sendEndPacket()
+    {
+        vector<uint8_t> endPkt = makePacket(END, startSeq, nullptr, 0);
+        while (true)
+        {
+            sendData(endPkt);
+            endTime = now() + ms(500);
+            PacketHeader ack{};
+            if (recvData(ack) && ack.type == ACK && ack.seqNum == startSeq)
+            {
+                spdlog::debug("END handshake complete");
+                break;
+            }
+        }
+    }
+
+    // Batch mode against a receiver without FLAG_BATCH: one connection per
+    // file, the first on the session already started.
+    void sendEachFile()
+    {
+        spdlog::info("Receiver does not support batch mode, sending {} files one by one", batchFiles.size());
+        vector<batch::Entry> files = move(batchFiles);
+        string dir = input_file;
+        batchMode = false;
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            input_file = dir + "/" + files[i].path;
+            if (i > 0)
+            {
+                sendStartPacket();
+                applyPeerOptions();
+            }
+            prepareData();
+            sendAllDataPacketsOpt();
+            sendEndPacket();
+        }
+        if (files.empty())
+            sendEndPacket();
+    }
+
+    void runStripe()
+    {
+        prepareData();
+        sendAllDataPacketsOpt();
+        sendEndPacket();
+    }
+
+    // Striped mode: this object negotiates the session as stripe 0, then every
+    // stripe runs its own START/DATA/END exchange on its own socket and thread
+    // over a contiguous chunk range of the input file. The receiver places each
+    // flow's bytes at the stripeOffset announced in its START.
+    void sendStriped()
+    {
+        ifstream is(input_file, ios::binary | ios::ate);
+        uint64_t fileSize = is ? static_cast<uint64_t>(is.tellg()) : 0;
+        is.close();
+        uint64_t numChunks = (fileSize + payloadSize - 1) / payloadSize;
+        uint32_t count = static_cast<uint32_t>(max<uint64_t>(1, min<uint64_t>(stripes, numChunks)));
+
+        StartOptions opts = makeOffer();
+        opts.stripeCount = count;
+        startOpts = opts;
+
+        createSocket();
+        sendStartPacket();
+        if (!peerOpts || peerOpts->sessionId != opts.sessionId)
+        {
+            spdlog::info("Receiver does not support striping, sending on a single flow");
+            peerOpts.reset();
+            applyPeerOptions();
+            runStripe();
+            writeStats("end");
+            return;
+        }
+        applyPeerOptions();
+        opts.payloadSize = payloadSize;
+        opts.flags = peerOpts->flags;
+        numChunks = (fileSize + chunkSize() - 1) / chunkSize();
+
+        vector<unique_ptr<wSender>> flows;
+        for (uint32_t i = 1; i < count; i++)
+        {
+            auto flow = make_unique<wSender>();
+            flow->hostname = hostname;
+            flow->port = port;
+            flow->window_size = window_size;
+            flow->input_file = input_file;
+            flow->output_log = output_log + "." + to_string(i);
+            flow->payloadSize = payloadSize;
+            flow->useFec = useFec;
+            flow->useCompression = useCompression;
+            flow->useResume = useResume;
+            flow->dedupReference = dedupReference;
+            flow->prebuild = prebuild;
+            flow->checksumWorkers = checksumWorkers;
+            flow->hugePages = hugePages;
+            flow->useFlowControl = useFlowControl;
+            flow->useSack = useSack;
+            flow->useCrc32c = useCrc32c;
+            flow->autoWindow = autoWindow;
+            flow->windowCap = windowCap;
+            flow->maxWindowBytes = maxWindowBytes;
+            flow->outputStream.open(flow->output_log, ios::out | ios::trunc);
+            flow->reportsStats = false;
+            flow->startedAt = startedAt;
+            if (trace)
+            {
+                flow->trace = {trace.writer, trace::SENDER_PID, i};
+                trace.writer->nameThread(trace::SENDER_PID, i, "flow " + to_string(i));
+            }
+            stripeCounters.push_back(&flow->counters);
+            flows.push_back(move(flow));
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            wSender &flow = (i == 0) ? *this : *flows[i - 1];
+            uint64_t firstChunk = numChunks * i / count;
+            uint64_t lastChunk = numChunks * (i + 1) / count;
+            flow.fileOffset = min(firstChunk * chunkSize(), fileSize);
+            flow.fileLength = min(lastChunk * chunkSize(), fileSize) - flow.fileOffset;
+            opts.stripeIndex = i;
+            opts.stripeOffset = flow.fileOffset;
+            flow.startOpts = opts;
+        }
+
+        vector<thread> threads;
+        threads.emplace_back([this]
+                             { runStripe(); });
+        for (auto &flow : flows)
+        {
+            wSender *f = flow.get();
+            threads.emplace_back([f]
+                                 {
+                f->createSocket();
+                f->sendStartPacket();
+                f->applyPeerOptions();
+                f->runStripe(); });
+        }
+        for (auto &t : threads)
+            t.join();
+        writeStats("end");
+        stripeCounters.clear(); // the flows go away with this frame
+    }
+
+    // The whole transfer, once parseArguments() has succeeded.
+    int run()
+    {
+        startedAt = now();
+        if (stripes > 1)
+        {
+            sendStriped();
+            spdlog::debug("All stripes sent and acknowledged");
+            return 0;
+        }
+        createSocket();
+        spdlog::debug("Socket created");
+        if (zeroRtt)
+            prepareZeroRtt();
+        sendStartPacket();
+        spdlog::debug("START packet sent and acknowledged");
+        applyPeerOptions();
+        if (batchMode && !(peerOpts && (peerOpts->flags & StartOptions::FLAG_BATCH)))
+        {
+            sendEachFile();
+            writeStats("end");
+            return 0;
+        }
+        if (!zeroRtt)
+            prepareData();
+        spdlog::debug("Sending {} data packets", pkts.size());
+        sendAllDataPacketsOpt();
+        spdlog::debug("All DATA packets sent and acknowledged");
+        sendEndPacket();
+        spdlog::debug("END packet sent and acknowledged");
+        writeStats("end");
+        return 0;
+    }
+};
@@ -0,0 +1,355 @@
+// wSim: runs wSenderOpt against wReceiverOpt in one thread over a simulated
+// link with virtual time, so protocol changes can be measured without
+// sockets or wall-clock timers. The same seed gives the same run.
+//
+// The sender runs its normal code. Each time it polls for a datagram and
+// none is waiting, the simulator takes the next event off its queue,
+// advancing virtual time to it: a datagram for the receiver is handed to
+// wReceiver::onDatagram() on the spot, and one for the sender is returned
+// from the poll. With nothing in flight, time moves on by one tick, which
+// is how the sender's retransmission timers come due.
+//
+// The sender prebuilds its packets, since the pipeline's threads run in
+// real time. --pipeline runs the pipeline anyway, which costs determinism
+// and inflates virtual time while the link waits on it, but shows that the
+// sender's memory stays bounded; --max-rss-mb turns that into a check.
+//
+// ./wSim -w 16 --megabytes 1024 --loss 0.05 --delay-ms 10
+// ./wSim -w 64 --megabytes 1024 --pipeline --max-rss-mb 64
+
+#include "../wReceiverOpt/wReceiverOpt.hpp"
+#include "../wSenderOpt/wSenderOpt.hpp"
+
+#include <sys/resource.h>
+
+#include <cstdio>
+#include <queue>
+
+class SimNetwork : public TimeSource
+{
+public:
+    // One direction of the link.
+    struct Link
+    {
+        double loss = 0;
+        double dup = 0;
+        double reorder = 0;       // chance a datagram is held back by up to jitter
+        Clock::duration delay{};  // one-way propagation delay
+        Clock::duration jitter{};
+        double bitsPerSecond = 0; // 0: no serialization delay
+        Clock::time_point busyUntil{};
+
+        uint64_t datagrams = 0;
+        uint64_t dropped = 0;
+        uint64_t duplicated = 0;
+        uint64_t reordered = 0;
+        uint64_t dataPackets = 0; // DATA and CDATA offered to the link
+    };
+
+    Link forward; // sender to receiver
+    Link reverse; // receiver to sender
+    Clock::duration tick = chrono::milliseconds(1);
+    wReceiver *receiver = nullptr;
+    sockaddr_in senderAddr{};
+    uint64_t events = 0;
+
+    explicit SimNetwork(uint64_t seed) : rng(seed)
+    {
+        senderAddr.sin_family = AF_INET;
+        senderAddr.sin_port = htons(40000);
+        senderAddr.sin_addr.s_addr = htonl(0x0a000001);
+    }
+
+    Clock::time_point now() override
+    {
+        return current;
+    }
+
+    void transmit(bool toReceiver, const void *data, size_t len)
+    {
+        Link &link = toReceiver ? forward : reverse;
+        link.datagrams++;
+        if (len >= sizeof(uint32_t))
+        {
+            uint32_t type = 0;
+            memcpy(&type, data, sizeof(type));
+            type = ntohl(type);
+            if (type == wSender::DATA || type == wSender::CDATA)
+                link.dataPackets++;
+        }
+        if (chance(link.loss))
+        {
+            link.dropped++;
+            return;
+        }
+        Clock::time_point departs = max(current, link.busyUntil);
+        if (link.bitsPerSecond > 0)
+            departs += chrono::duration_cast<Clock::duration>(chrono::duration<double>(len * 8 / link.bitsPerSecond));
+        link.busyUntil = departs;
+
+        int copies = chance(link.dup) ? 2 : 1;
+        link.duplicated += copies - 1;
+        for (int c = 0; c < copies; c++)
+        {
+            Clock::time_point at = departs + link.delay;
+            if (chance(link.reorder))
+            {
+                link.reordered++;
+                at += chrono::duration_cast<Clock::duration>(link.jitter * uniform(rng));
+            }
+            const uint8_t *bytes = static_cast<const uint8_t *>(data);
+            queue.push({at, order++, toReceiver, vector<uint8_t>(bytes, bytes + len)});
+        }
+    }
+
+    // The sender's non-blocking receive; see the top of this file.
+    ssize_t pollSender(void *buf, size_t cap, sockaddr_in &from)
+    {
+        if (queue.empty())
+        {
+            current += tick;
+            return -1;
+        }
+        Datagram d = queue.top();
+        queue.pop();
+        events++;
+        current = max(current, d.at);
+        if (d.toReceiver)
+        {
+            receiver->onDatagram(d.bytes.data(), static_cast<ssize_t>(d.bytes.size()), senderAddr);
+            return -1;
+        }
+        size_t n = min(cap, d.bytes.size());
+        memcpy(buf, d.bytes.data(), n);
+        from = senderAddr;
+        return static_cast<ssize_t>(n);
+    }
+
+private:
+    struct Datagram
+    {
+        Clock::time_point at;
+        uint64_t order; // FIFO among datagrams due at the same time
+        bool toReceiver;
+        vector<uint8_t> bytes;
+
+        bool operator>(const Datagram &o) const
+        {
+            return at != o.at ? at > o.at : order > o.order;
+        }
+    };
+
+    priority_queue<Datagram, vector<Datagram>, greater<Datagram>> queue;
+    uint64_t order = 0;
+    Clock::time_point current = Clock::time_point{} + chrono::seconds(1);
+    mt19937_64 rng;
+    uniform_real_distribution<double> uniform{0.0, 1.0};
+
+    bool chance(double p)
+    {
+        return p > 0 && uniform(rng) < p;
+    }
+};
+
+class SenderPort : public Transport
+{
+public:
+    explicit SenderPort(SimNetwork &net) : net(net) {}
+
+    ssize_t sendTo(const void *data, size_t len, const sockaddr_in &) override
+    {
+        net.transmit(true, data, len);
+        return static_cast<ssize_t>(len);
+    }
+
+    ssize_t recvFrom(void *buf, size_t cap, sockaddr_in &from, bool) override
+    {
+        return net.pollSender(buf, cap, from);
+    }
+
+private:
+    SimNetwork &net;
+};
+
+// The receiver is driven through onDatagram(), so it never calls recvFrom.
+class ReceiverPort : public Transport
+{
+public:
+    explicit ReceiverPort(SimNetwork &net) : net(net) {}
+
+    ssize_t sendTo(const void *data, size_t len, const sockaddr_in &) override
+    {
+        net.transmit(false, data, len);
+        return static_cast<ssize_t>(len);
+    }
+
+    ssize_t recvFrom(void *, size_t, sockaddr_in &, bool) override
+    {
+        return -1;
+    }
+
+private:
+    SimNetwork &net;
+};
+
+// Writes size pseudo-random bytes from seed to path.
+static bool writeInput(const string &path, uint64_t size, uint64_t seed)
+{
+    ofstream out(path, ios::binary | ios::trunc);
+    mt19937_64 rng(seed);
+    vector<uint64_t> block(1 << 16);
+    for (uint64_t left = size; left > 0 && out;)
+    {
+        for (auto &w : block)
+            w = rng();
+        size_t n = static_cast<size_t>(min<uint64_t>(left, block.size() * sizeof(uint64_t)));
+        out.write(reinterpret_cast<const char *>(block.data()), static_cast<streamsize>(n));
+        left -= n;
+    }
+    return static_cast<bool>(out);
+}
+
+static bool sameContents(const string &a, const string &b)
+{
+    ifstream fa(a, ios::binary), fb(b, ios::binary);
+    vector<char> ba(1 << 20), bb(1 << 20);
+    while (fa && fb)
+    {
+        fa.read(ba.data(), static_cast<streamsize>(ba.size()));
+        fb.read(bb.data(), static_cast<streamsize>(bb.size()));
+        if (fa.gcount() != fb.gcount() || memcmp(ba.data(), bb.data(), static_cast<size_t>(fa.gcount())) != 0)
+            return false;
+    }
+    return fa.eof() && fb.eof();
+}
+
+static vector<char *> argvOf(vector<string> &args)
+{
+    vector<char *> argv;
+    for (auto &a : args)
+        argv.push_back(a.data());
+    return argv;
+}
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options opts("wSim", "Deterministic simulation of a wSenderOpt to wReceiverOpt transfer.");
+    opts.add_options()("w,window-size", "Window size of both endpoints, or \"auto\".", cxxopts::value<string>()->default_value("16"))("m,megabytes", "Size of the simulated file in MiB.", cxxopts::value<uint64_t>()->default_value("64"))("loss", "Chance each datagram is lost, in both directions.", cxxopts::value<double>()->default_value("0"))("dup", "Chance each datagram is delivered twice.", cxxopts::value<double>()->default_value("0"))("reorder", "Chance each datagram is held back by up to --jitter-ms.", cxxopts::value<double>()->default_value("0"))("jitter-ms", "Longest hold-back of a reordered datagram.", cxxopts::value<double>()->default_value("5"))("delay-ms", "One-way propagation delay.", cxxopts::value<double>()->default_value("10"))("rate-mbps", "Link rate in Mbit/s each way; 0 for no serialization delay.", cxxopts::value<double>()->default_value("0"))("tick-us", "How far virtual time moves when nothing is in flight.", cxxopts::value<int>()->default_value("1000"))("seed", "Seed for the file contents and the link's randomness.", cxxopts::value<uint64_t>()->default_value("1"))("fec", "Run the sender with --fec.", cxxopts::value<bool>()->default_value("false"))("compress", "Run the sender with --compress.", cxxopts::value<bool>()->default_value("false"))("pipeline", "Run the sender's reader pipeline instead of --prebuild.", cxxopts::value<bool>()->default_value("false"))("max-rss-mb", "Fail if the peak resident set exceeds this many MiB; 0 for no limit.", cxxopts::value<uint64_t>()->default_value("0"))("dir", "Directory for the input and output files, removed afterwards.", cxxopts::value<string>()->default_value(filesystem::temp_directory_path().string()))("trace", "Trace both endpoints into this Chrome trace JSON file, in virtual time.", cxxopts::value<string>()->default_value(""))("help", "Print usage.");
+
+    cxxopts::ParseResult result;
+    try
+    {
+        result = opts.parse(argc, argv);
+    }
+    catch (const exception &e)
+    {
+        cerr << "Error parsing options: " << e.what() << "\n\n"
+             << opts.help() << "\n";
+        return 1;
+    }
+    if (result.count("help"))
+    {
+        cout << opts.help() << "\n";
+        return 0;
+    }
+
+    spdlog::set_level(spdlog::level::warn);
+    uint64_t seed = result["seed"].as<uint64_t>();
+    uint64_t size = result["megabytes"].as<uint64_t>() << 20;
+    string window = result["window-size"].as<string>();
+    auto millis = [](double v)
+    { return chrono::duration_cast<TimeSource::Clock::duration>(chrono::duration<double, milli>(v)); };
+
+    filesystem::path dir = filesystem::path(result["dir"].as<string>()) / ("wSim-" + to_string(getpid()));
+    filesystem::create_directories(dir);
+    string input = (dir / "input.bin").string();
+    if (!writeInput(input, size, seed))
+    {
+        spdlog::error("Cannot write the simulated input to {}", input);
+        return 1;
+    }
+
+    SimNetwork net(seed);
+    for (SimNetwork::Link *link : {&net.forward, &net.reverse})
+    {
+        link->loss = result["loss"].as<double>();
+        link->dup = result["dup"].as<double>();
+        link->reorder = result["reorder"].as<double>();
+        link->jitter = millis(result["jitter-ms"].as<double>());
+        link->delay = millis(result["delay-ms"].as<double>());
+        link->bitsPerSecond = result["rate-mbps"].as<double>() * 1e6;
+    }
+    net.tick = chrono::microseconds(max(1, result["tick-us"].as<int>()));
+
+    // Both endpoints parse ordinary command lines; logs go nowhere.
+    vector<string> receiverArgs = {"wReceiver", "-p", "4000", "-w", window, "-d", dir.string(), "-o", "/dev/null"};
+    vector<string> senderArgs = {"wSender", "-h", "127.0.0.1", "-p", "4000", "-w", window, "-i", input, "-o", "/dev/null"};
+    if (!result["pipeline"].as<bool>())
+        senderArgs.push_back("--prebuild");
+    if (result["fec"].as<bool>())
+        senderArgs.push_back("--fec");
+    if (result["compress"].as<bool>())
+        senderArgs.push_back("--compress");
+
+    wReceiver receiver;
+    wSender sender;
+    auto rargv = argvOf(receiverArgs);
+    auto sargv = argvOf(senderArgs);
+    if (receiver.parseArguments(static_cast<int>(rargv.size()), rargv.data()) ||
+        sender.parseArguments(static_cast<int>(sargv.size()), sargv.data()))
+        return 1;
+
+    ReceiverPort receiverPort(net);
+    SenderPort senderPort(net);
+    receiver.transport = &receiverPort;
+    receiver.clock = &net;
+    sender.transport = &senderPort;
+    sender.clock = &net;
+    net.receiver = &receiver;
+
+    trace::Writer traceFile;
+    string tracePath = result["trace"].as<string>();
+    if (!tracePath.empty())
+    {
+        if (!traceFile.open(tracePath))
+        {
+            spdlog::error("Cannot write trace file {}", tracePath);
+            return 1;
+        }
+        traceFile.nameProcess(trace::SENDER_PID, "wSender");
+        traceFile.nameThread(trace::SENDER_PID, 0, "flow 0");
+        traceFile.nameProcess(trace::RECEIVER_PID, "wReceiver");
+        sender.trace = {&traceFile, trace::SENDER_PID, 0};
+        receiver.tracer = &traceFile;
+    }
+
+    auto wallStart = chrono::steady_clock::now();
+    auto simStart = net.now();
+    sender.run();
+    double simSeconds = chrono::duration<double>(net.now() - simStart).count();
+    double wallSeconds = chrono::duration<double>(chrono::steady_clock::now() - wallStart).count();
+
+    bool verified = sameContents(input, (dir / "FILE-0.out").string());
+    uint64_t chunks = sender.pkts.size();
+    printf("transfer     %llu bytes in %llu DATA packets, %s\n", static_cast<unsigned long long>(size),
+           static_cast<unsigned long long>(chunks), verified ? "output verified" : "OUTPUT DIFFERS");
+    printf("virtual time %.3f s, goodput %.2f Mbit/s\n", simSeconds, simSeconds > 0 ? size * 8 / simSeconds / 1e6 : 0.0);
+    printf("forward      %llu datagrams, %llu DATA (%llu retransmitted), %llu lost, %llu duplicated, %llu reordered\n",
+           static_cast<unsigned long long>(net.forward.datagrams), static_cast<unsigned long long>(net.forward.dataPackets),
+           static_cast<unsigned long long>(net.forward.dataPackets - min(chunks, net.forward.dataPackets)),
+           static_cast<unsigned long long>(net.forward.dropped), static_cast<unsigned long long>(net.forward.duplicated),
+           static_cast<unsigned long long>(net.forward.reordered));
+    printf("reverse      %llu datagrams, %llu lost\n", static_cast<unsigned long long>(net.reverse.datagrams),
+           static_cast<unsigned long long>(net.reverse.dropped));
+    printf("wall time    %.3f s for %llu events\n", wallSeconds, static_cast<unsigned long long>(net.events));
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    uint64_t peakMiB = static_cast<uint64_t>(ru.ru_maxrss) >> 10; // ru_maxrss is in KiB
+    uint64_t maxMiB = result["max-rss-mb"].as<uint64_t>();
+    bool bounded = maxMiB == 0 || peakMiB <= maxMiB;
+    printf("peak RSS     %llu MiB%s\n", static_cast<unsigned long long>(peakMiB), bounded ? "" : ", OVER THE LIMIT");
+
+    error_code ec;
+    filesystem::remove_all(dir, ec);
+    return !verified ? 2 : !bounded ? 3 : 0;
+}
@@ -0,0 +1,360 @@
+// wtp_bench: micro-benchmarks for the per-packet work on both hot paths, so
+// kernel and data-structure changes can be compared by number:
+//
+//   crc32/<bytes>           checksum over one buffer, folded with PCLMULQDQ where available
+//   crc32-table/<bytes>     CRC32's byte-wise table fallback
+//   crc32c/<bytes>          the same with CRC32C, in hardware where available
+//   crc32c-table/<bytes>    CRC32C's byte-wise table fallback
+//   copy+crc32/<bytes>      fused copy and checksum, see CopyChecksum.hpp
+//   memcpy+crc32/<bytes>    the same kernel without stores, then memcpy
+//   copy+crc32c/<bytes>     fused copy and CRC32C
+//   memcpy+crc32c/<bytes>   the same as two passes
+//   encode/...              header byte swaps and whole-packet assembly
+//   decode/...              header parse, and verification as the receiver does it
+//   reorder/<pattern>       ReorderBuffer fed one window's arrival pattern
+//
+// Each benchmark is calibrated so one sample runs for --sample-ms, then
+// timed over --samples samples. The report gives the median ns/op (and
+// GB/s where bytes are involved), the fastest sample, and the p10-p90
+// spread as a share of the median; a wide spread means a noisy machine.
+//
+// ./wtp_bench --filter crc32 --samples 31
+
+#include "../wReceiverOpt/wReceiverOpt.hpp"
+#include "../wSenderOpt/wSenderOpt.hpp"
+
+#include <cstdio>
+#include <functional>
+
+// Keeps the compiler from discarding a result nobody reads.
+template <typename T>
+static inline void keep(const T &value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct Benchmark
+{
+    string name;
+    size_t bytesPerOp; // 0 when throughput means nothing
+    function<void(uint64_t iterations)> body;
+};
+
+class BenchRunner
+{
+public:
+    int samples = 21;
+    chrono::nanoseconds sampleTime = chrono::milliseconds(20);
+    string filter;
+
+    void run(const Benchmark &b)
+    {
+        if (!filter.empty() && b.name.find(filter) == string::npos)
+            return;
+
+        uint64_t iterations = calibrate(b);
+        vector<double> nsPerOp;
+        for (int s = 0; s < samples; s++)
+        {
+            auto start = chrono::steady_clock::now();
+            b.body(iterations);
+            auto elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+            nsPerOp.push_back(elapsed / iterations);
+        }
+        sort(nsPerOp.begin(), nsPerOp.end());
+        double median = nsPerOp[nsPerOp.size() / 2];
+        double p10 = nsPerOp[nsPerOp.size() / 10];
+        double p90 = nsPerOp[nsPerOp.size() * 9 / 10];
+        double spread = median > 0 ? (p90 - p10) / median * 100 : 0;
+
+        if (b.bytesPerOp)
+            printf("%-28s %12.2f ns/op %9.2f GB/s   min %10.2f ns   spread %5.1f%%\n", b.name.c_str(), median,
+                   b.bytesPerOp / median, nsPerOp.front(), spread);
+        else
+            printf("%-28s %12.2f ns/op %14s   min %10.2f ns   spread %5.1f%%\n", b.name.c_str(), median, "",
+                   nsPerOp.front(), spread);
+        fflush(stdout);
+    }
+
+private:
+    // Grows the iteration count until one run lasts a sample's time.
+    uint64_t calibrate(const Benchmark &b)
+    {
+        uint64_t iterations = 1;
+        while (true)
+        {
+            auto start = chrono::steady_clock::now();
+            b.body(iterations);
+            auto elapsed = chrono::steady_clock::now() - start;
+            if (elapsed >= sampleTime || iterations >= (uint64_t(1) << 40))
+                return iterations;
+            if (elapsed < sampleTime / 16)
+                iterations *= 8;
+            else
+                iterations = static_cast<uint64_t>(iterations * 1.2 * sampleTime.count() / max<int64_t>(1, chrono::duration_cast<chrono::nanoseconds>(elapsed).count())) + 1;
+        }
+    }
+};
+
+static vector<uint8_t> randomBytes(size_t n, uint64_t seed)
+{
+    mt19937_64 rng(seed);
+    vector<uint8_t> v(n);
+    for (auto &b : v)
+        b = static_cast<uint8_t>(rng());
+    return v;
+}
+
+// Arrival orders of seqNums [0, count), shaped within each window.
+static vector<uint32_t> arrivalOrder(const string &pattern, uint32_t count, uint32_t window)
+{
+    vector<uint32_t> order(count);
+    iota(order.begin(), order.end(), 0);
+    mt19937 rng(7);
+    for (uint32_t base = 0; base < count; base += window)
+    {
+        auto first = order.begin() + base;
+        auto last = order.begin() + min(count, base + window);
+        if (pattern == "reverse")
+            reverse(first + 1, last); // the window's head arrives last
+        else if (pattern == "swap")
+            for (auto it = first; it + 1 < last; it += 2)
+                iter_swap(it, it + 1);
+        else if (pattern == "hole")
+            rotate(first, first + 1, last); // head lost, everything else buffered
+        else if (pattern == "shuffle")
+            shuffle(first, last, rng);
+    }
+    return order;
+}
+
+// Feeds arrivals through a ReorderBuffer the way the receiver does: the
+// in-order packet is consumed and drains whatever it unblocks, anything
+// else is buffered. One op is one arrival; not every arrival copies, so no
+// throughput is reported.
+static Benchmark reorderBenchmark(const string &pattern, uint32_t window, size_t payload)
+{
+    const uint32_t count = window * 64;
+    auto order = make_shared<vector<uint32_t>>(arrivalOrder(pattern, count, window));
+    auto data = make_shared<vector<uint8_t>>(randomBytes(payload, 3));
+    auto buffer = make_shared<ReorderBuffer>();
+    buffer->reset(window, payload);
+    return {"reorder/" + pattern + "/w" + to_string(window), 0, [=](uint64_t iterations)
+            {
+                uint64_t sink = 0;
+                uint32_t next = 0;
+                for (uint64_t i = 0; i < iterations; i++)
+                {
+                    size_t k = i % count;
+                    if (k == 0)
+                        next = 0;
+                    uint32_t seq = (*order)[k];
+                    if (seq != next)
+                    {
+                        buffer->put(seq, data->data(), data->size());
+                        continue;
+                    }
+                    next++;
+                    size_t len;
+                    while (const uint8_t *p = buffer->take(next, len))
+                    {
+                        sink += p[0] + len;
+                        next++;
+                    }
+                }
+                keep(sink);
+            }};
+}
+
+int main(int argc, char **argv)
+{
+    cxxopts::Options opts("wtp_bench", "Micro-benchmarks for checksums, packet encode/decode and the reorder buffer.");
+    opts.add_options()("samples", "Timed samples per benchmark.", cxxopts::value<int>()->default_value("21"))("sample-ms", "Target length of one sample.", cxxopts::value<int>()->default_value("20"))("filter", "Only run benchmarks whose name contains this.", cxxopts::value<string>()->default_value(""))("help", "Print usage.");
+
+    cxxopts::ParseResult result;
+    try
+    {
+        result = opts.parse(argc, argv);
+    }
+    catch (const exception &e)
+    {
+        cerr << "Error parsing options: " << e.what() << "\n\n"
+             << opts.help() << "\n";
+        return 1;
+    }
+    if (result.count("help"))
+    {
+        cout << opts.help() << "\n";
+        return 0;
+    }
+
+    spdlog::set_level(spdlog::level::warn);
+    BenchRunner runner;
+    runner.samples = max(3, result["samples"].as<int>());
+    runner.sampleTime = chrono::milliseconds(max(1, result["sample-ms"].as<int>()));
+    runner.filter = result["filter"].as<string>();
+
+    const size_t payload = StartOptions::DEFAULT_PAYLOAD;
+    wReceiver receiver;
+    wSender sender;
+
+    for (size_t n : {64, 256, 1024, static_cast<int>(payload), 4096, 65536, 1 << 20})
+    {
+        auto data = make_shared<vector<uint8_t>>(randomBytes(n, n));
+        runner.run({"crc32/" + to_string(n), n, [data](uint64_t iterations)
+                    {
+                        uint32_t sum = 0;
+                        for (uint64_t i = 0; i < iterations; i++)
+                        {
+                            sum += crc32(data->data(), data->size());
+                            keep(sum);
+                        }
+                    }});
+        runner.run({"crc32-table/" + to_string(n), n, [data](uint64_t iterations)
+                    {
+                        uint32_t sum = 0;
+                        for (uint64_t i = 0; i < iterations; i++)
+                        {
+                            sum += ieee::software(~0u, data->data(), data->size());
+                            keep(sum);
+                        }
+                    }});
+        runner.run({"crc32c/" + to_string(n), n, [data](uint64_t iterations)
+                    {
+                        uint32_t sum = 0;
+                        for (uint64_t i = 0; i < iterations; i++)
+                        {
+                            sum += crc32c(data->data(), data->size());
+                            keep(sum);
+                        }
+                    }});
+        runner.run({"crc32c-table/" + to_string(n), n, [data](uint64_t iterations)
+                    {
+                        uint32_t sum = 0;
+                        for (uint64_t i = 0; i < iterations; i++)
+                        {
+                            sum += castagnoli::software(~0u, data->data(), data->size());
+                            keep(sum);
+                        }
+                    }});
+        auto out = make_shared<vector<uint8_t>>(n);
+        runner.run({"copy+crc32/" + to_string(n), n, [data, out](uint64_t iterations)
+                    {
+                        uint32_t sum = 0;
+                        for (uint64_t i = 0; i < iterations; i++)
+                        {
+                            sum += crc32Copy(out->data(), data->data(), data->size());
+                            keep(sum);
+                        }
+                    }});
+        runner.run({"memcpy+crc32/" + to_string(n), n, [data, out](uint64_t iterations)
+                    {
+                        uint32_t sum = 0;
+                        for (uint64_t i = 0; i < iterations; i++)
+                        {
+                            sum += crc32(data->data(), data->size());
+                            memcpy(out->data(), data->data(), data->size());
+                            keep(sum);
+                        }
+                    }});
+        runner.run({"copy+crc32c/" + to_string(n), n, [data, out](uint64_t iterations)
+                    {
+                        uint32_t sum = 0;
+                        for (uint64_t i = 0; i < iterations; i++)
+                        {
+                            sum += crc32cCopy(out->data(), data->data(), data->size());
+                            keep(sum);
+                        }
+                    }});
+        runner.run({"memcpy+crc32c/" + to_string(n), n, [data, out](uint64_t iterations)
+                    {
+                        uint32_t sum = 0;
+                        for (uint64_t i = 0; i < iterations; i++)
+                        {
+                            sum += crc32c(data->data(), data->size());
+                            memcpy(out->data(), data->data(), data->size());
+                            keep(sum);
+                        }
+                    }});
+    }
+
+    runner.run({"encode/htonl_func", sizeof(PacketHeader), [&](uint64_t iterations)
+                {
+                    PacketHeader h{2, 1, static_cast<uint32_t>(payload), 0xdeadbeef};
+                    for (uint64_t i = 0; i < iterations; i++)
+                    {
+                        h.seqNum = static_cast<uint32_t>(i);
+                        receiver.htonl_func(h);
+                        keep(h);
+                    }
+                }});
+
+    runner.run({"decode/ntohl_func", sizeof(PacketHeader), [&](uint64_t iterations)
+                {
+                    PacketHeader h{htonl(2), 1, htonl(static_cast<uint32_t>(payload)), 0xdeadbeef};
+                    for (uint64_t i = 0; i < iterations; i++)
+                    {
+                        h.seqNum = static_cast<uint32_t>(i);
+                        receiver.ntohl_func(h);
+                        keep(h);
+                    }
+                }});
+
+    runner.run({"encode/makePacket/ack", sizeof(PacketHeader), [&](uint64_t iterations)
+                {
+                    vector<uint8_t> pkt;
+                    for (uint64_t i = 0; i < iterations; i++)
+                    {
+                        receiver.makePacket(pkt, ACK, static_cast<uint32_t>(i), nullptr, 0);
+                        keep(pkt.data());
+                    }
+                }});
+
+    auto chunk = make_shared<vector<uint8_t>>(randomBytes(payload, 1));
+    // The sender's assembly of a packet it does not keep in the arena.
+    runner.run({"encode/makePacket/data", payload, [&, chunk](uint64_t iterations)
+                {
+                    for (uint64_t i = 0; i < iterations; i++)
+                    {
+                        vector<uint8_t> pkt = sender.makePacket(DATA, static_cast<uint32_t>(i), chunk->data(), chunk->size());
+                        keep(pkt.data());
+                    }
+                }});
+
+    runner.run({"encode/buildDataPacket", payload, [&, chunk](uint64_t iterations)
+                {
+                    vector<uint8_t> slot(sizeof(PacketHeader) + payload);
+                    size_t len = 0;
+                    for (uint64_t i = 0; i < iterations; i++)
+                    {
+                        len += sender.buildDataPacket(static_cast<uint32_t>(i), chunk->data(), chunk->size(), nullptr, slot.data());
+                        keep(slot.data());
+                    }
+                    keep(len);
+                }});
+
+    // The receiver's per-datagram check: parse the header, then verify the
+    // payload while copying it to its landing slot, as handleDataPacket does.
+    vector<uint8_t> wire;
+    receiver.makePacket(wire, DATA, 42, chunk->data(), chunk->size());
+    runner.run({"decode/verify", payload, [&](uint64_t iterations)
+                {
+                    vector<uint8_t> landing(payload);
+                    uint64_t good = 0;
+                    for (uint64_t i = 0; i < iterations; i++)
+                    {
+                        PacketHeader h;
+                        memcpy(&h, wire.data(), sizeof(h));
+                        receiver.ntohl_func(h);
+                        good += h.length <= min(wire.size() - sizeof(h), landing.size()) &&
+                                receiver.copyChecksumOf(landing.data(), wire.data() + sizeof(h), h.length) == h.checksum;
+                        keep(good);
+                    }
+                }});
+
+    for (uint32_t window : {16u, 256u})
+        for (const char *pattern : {"inorder", "swap", "reverse", "hole", "shuffle"})
+            runner.run(reorderBenchmark(pattern, window, payload));
+
+    return 0;
+}